@@ -1,13 +1,25 @@
+#define _POSIX_C_SOURCE 200809L  // -std=c99 下 mmap、fstat 等需要这个
+
+#include <fcntl.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
 #include "cachelab.h"
+#include "tracefmt.h"
 
 void print_help() {
-    printf("Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file> [-k <name>] [-B]\n");
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
@@ -15,19 +27,46 @@ void print_help() {
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of block offset bits.\n");
     printf("  -t <file>  Trace file.\n");
+    printf("  -k <name>  Tag match kernel: scalar, sse2 or avx2 (default: avx2 if E >= 16 and supported, else scalar).\n");
+    printf("  -B         Benchmark the tag match kernels and exit.\n");
     printf("\n");
     printf("Examples:\n");
     printf("  linux>  ./csim-ref -s 4 -E 1 -b 4 -t traces/yi.trace\n");
     printf("  linux>  ./csim-ref -v -s 8 -E 2 -b 4 -t traces/yi.trace\n");
 }
 
-typedef struct cache_line_ {
-    int valid;       // 有效位
-    int tag;         // 标志位
-    int time_stamp;  // 时间戳，用于 LRU 替换
-} CacheLine;
+#define HASH_MIN_E 32  // 每组超过这么多行时用哈希表查 tag，否则直接扫描
+#define MAX_E 65535    // 组内行号用 16 位存，最大的值留给 NIL
+#define NIL 0xffff     // LRU 链表里表示没有
+#define SIMD_MIN_E 16  // 每组至少这么多行时默认才用 AVX2，行数少时标量循环更快
+#define TAG_PAD 8      // tag 数组末尾多留的项，向量加载越过最后一组的末尾也不会越界
+
+typedef unsigned short link_t;  // 组内行号
+
+// 每组的行按使用先后串成双向链表，命中和替换都是 O(1)
+typedef struct cache_set_ {
+    link_t head;  // 最近使用的行
+    link_t tail;  // 最久未用的行，替换时直接取它
+    link_t used;  // 已装入的行数。行按下标顺序装入且不会失效，所以前 used 行都有效，不需要有效位
+} CacheSet;
 
-CacheLine **cache;
+// 开放定址（线性探测）哈希表的槽，键是 (组号, tag)
+typedef struct hash_slot_ {
+    unsigned long tag;
+    unsigned int group;
+    int line;  // 组内行号，-1 表示空槽
+} HashSlot;
+
+// 行的各个字段拆成数组，和组信息一起放在一次分配的连续内存里，第 g 组第 i 行的下标是 g * E + i。
+// 一组的 tag 紧挨在一起，查找时顺序扫过，不用追指针
+unsigned long *tags;  // 完整的 64 位 tag
+link_t *lru_prev;     // LRU 链表中比它更近使用的行
+link_t *lru_next;     // LRU 链表中比它更久未用的行
+CacheSet *sets;
+HashSlot *hash_table = NULL;  // 只有 E > HASH_MIN_E 时才建
+unsigned long hash_mask;
+
+#define LINE(group, i) ((size_t)(group) * E + (i))
 
 int hit_count = 0, miss_count = 0, eviction_count = 0;
 int s, b, E, S, B;
@@ -37,53 +76,198 @@ char t[100];
 void init_cache() {
     S = 1 << s;
     B = 1 << b;
-    cache = (CacheLine **)malloc(sizeof(CacheLine *) * S);
-    for (int i = 0; i < S; i++) {
-        cache[i] = (CacheLine *)malloc(sizeof(CacheLine) * E);
-        for (int j = 0; j < E; j++) {
-            cache[i][j].valid = 0;
-            cache[i][j].tag = 0;
-            cache[i][j].time_stamp = 0;
+    size_t lines = (size_t)S * E;
+
+    // tag、两个链表数组、组信息依次排开，对齐要求高的在前。calloc 的页用到才会分配
+    char *mem = calloc(1, (lines + TAG_PAD) * sizeof(unsigned long) + lines * 2 * sizeof(link_t) + S * sizeof(CacheSet));
+    if (mem == NULL) {
+        printf("out of memory\n");
+        exit(-1);
+    }
+    tags = (unsigned long *)mem;
+    lru_prev = (link_t *)(tags + lines + TAG_PAD);
+    lru_next = lru_prev + lines;
+    sets = (CacheSet *)(lru_next + lines);
+    for (int i = 0; i < S; i++) sets[i].head = sets[i].tail = NIL;
+
+    if (E > HASH_MIN_E) {  // 槽数取不小于总行数两倍的 2 的幂，装载率不超过一半
+        unsigned long n = 1;
+        while (n < 2 * lines) n <<= 1;
+        hash_mask = n - 1;
+        hash_table = (HashSlot *)malloc(sizeof(HashSlot) * n);
+        if (hash_table == NULL) {
+            printf("out of memory\n");
+            exit(-1);
         }
+        for (unsigned long i = 0; i < n; i++) hash_table[i].line = -1;
     }
 }
 
-void LRU_time_inc(int g) {
-    for (int i = 0; i < E; i++)
-        if (cache[g][i].valid) cache[g][i].time_stamp += 1;
+unsigned long hash_home(unsigned long tag, unsigned group) {
+    unsigned long x = tag * 0x9e3779b97f4a7c15UL ^ (unsigned long)group;
+    x ^= x >> 29;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 32;
+    return x & hash_mask;
 }
 
-int LRU_evic_index(int group) {
-    int max_time = -1, line;
-    for (int i = 0; i < E; i++) {
-        if (cache[group][i].time_stamp > max_time) {
-            max_time = cache[group][i].time_stamp;
-            line = i;
-        }
+int hash_find(unsigned long tag, unsigned group) {
+    for (unsigned long i = hash_home(tag, group); hash_table[i].line != -1; i = (i + 1) & hash_mask)
+        if (hash_table[i].tag == tag && hash_table[i].group == group) return hash_table[i].line;
+    return -1;
+}
+
+void hash_insert(unsigned long tag, unsigned group, int line) {
+    unsigned long i = hash_home(tag, group);
+    while (hash_table[i].line != -1) i = (i + 1) & hash_mask;
+    hash_table[i].tag = tag;
+    hash_table[i].group = group;
+    hash_table[i].line = line;
+}
+
+// 删除后把后面同一探测链上的槽往前挪，这样不需要墓碑
+void hash_remove(unsigned long tag, unsigned group) {
+    unsigned long i = hash_home(tag, group), j, k;
+    while (hash_table[i].tag != tag || hash_table[i].group != group) i = (i + 1) & hash_mask;
+    hash_table[i].line = -1;
+    for (j = (i + 1) & hash_mask; hash_table[j].line != -1; j = (j + 1) & hash_mask) {
+        k = hash_home(hash_table[j].tag, hash_table[j].group);
+        // k 落在 (i, j] 之间（考虑回绕）时这一项还能从 k 探测到，不用挪
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        hash_table[i] = hash_table[j];
+        hash_table[j].line = -1;
+        i = j;
     }
-    return line;
 }
 
-int hit_index(int tag, int group) {
-    for (int i = 0; i < E; i++)
-        if (cache[group][i].valid && cache[group][i].tag == tag) return i;
+// 把 line 从组的 LRU 链表中摘下
+void LRU_unlink(unsigned group, int line) {
+    link_t prev = lru_prev[LINE(group, line)], next = lru_next[LINE(group, line)];
+    if (prev != NIL) lru_next[LINE(group, prev)] = next;
+    else sets[group].head = next;
+    if (next != NIL) lru_prev[LINE(group, next)] = prev;
+    else sets[group].tail = prev;
+}
+
+// 把 line 放到组的 LRU 链表头，成为最近使用的行
+void LRU_push_front(unsigned group, int line) {
+    link_t head = sets[group].head;
+    lru_prev[LINE(group, line)] = NIL;
+    lru_next[LINE(group, line)] = head;
+    if (head != NIL) lru_prev[LINE(group, head)] = line;
+    else sets[group].tail = line;
+    sets[group].head = line;
+}
+
+int LRU_evic_index(unsigned group) {
+    return sets[group].tail;
+}
+
+void free_cache() {
+    free(tags);
+    free(hash_table);
+    hash_table = NULL;
+}
+
+// 在一组的前 n 个 tag 里找 tag，返回行号，找不到返回 -1。
+// 有效的行里 tag 不会重复，所以向量版本取比较结果中最低的一位就行；
+// 超过 n 的那些 tag 可能是 0 或者别的组的，比较结果要按 n 截掉
+int match_scalar(const unsigned long *set_tags, int n, unsigned long tag) {
+    for (int i = 0; i < n; i++)
+        if (set_tags[i] == tag) return i;
+    return -1;
+}
+
+#ifdef HAVE_X86
+// SSE2 没有 64 位相等比较：比较两个 32 位的半边，再把每个 64 位元素的两半相与
+static inline unsigned eq_mask_sse2(const unsigned long *p, __m128i key) {
+    __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)p), key);
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_movemask_pd(_mm_castsi128_pd(eq));
+}
+
+// 每轮比较 4 个 tag，合成一个掩码再判断，少一半分支
+int match_sse2(const unsigned long *set_tags, int n, unsigned long tag) {
+    __m128i key = _mm_set1_epi64x((long long)tag);
+    for (int i = 0; i < n; i += 4) {
+        unsigned mask = eq_mask_sse2(set_tags + i, key) | eq_mask_sse2(set_tags + i + 2, key) << 2;
+        if (n - i < 4) mask &= (1u << (n - i)) - 1;
+        if (mask) return i + __builtin_ctz(mask);
+    }
     return -1;
 }
 
-int empty_index(int group) {
-    for (int i = 0; i < E; i++)
-        if (!cache[group][i].valid) return i;
+__attribute__((target("avx2"))) static inline unsigned eq_mask_avx2(const unsigned long *p, __m256i key) {
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)p), key);
+    return _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+}
+
+// 每轮比较 8 个 tag
+__attribute__((target("avx2"))) int match_avx2(const unsigned long *set_tags, int n, unsigned long tag) {
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+    for (int i = 0; i < n; i += 8) {
+        unsigned mask = eq_mask_avx2(set_tags + i, key) | eq_mask_avx2(set_tags + i + 4, key) << 4;
+        if (n - i < 8) mask &= (1u << (n - i)) - 1;
+        if (mask) return i + __builtin_ctz(mask);
+    }
     return -1;
 }
+#endif
+
+typedef int (*match_fn)(const unsigned long *, int, unsigned long);
+
+typedef struct kernel_ {
+    const char *name;
+    match_fn fn;
+    int supported;
+} Kernel;
+
+Kernel kernels[] = {
+    {"scalar", match_scalar, 1},
+#ifdef HAVE_X86
+    {"sse2", match_sse2, 0},
+    {"avx2", match_avx2, 0},
+#endif
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+match_fn match_tag = match_scalar;
+
+// 检查 CPU 支持哪些 kernel
+void probe_kernels() {
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    kernels[1].supported = __builtin_cpu_supports("sse2");
+    kernels[2].supported = __builtin_cpu_supports("avx2");
+#endif
+}
 
-void update_cache(int tag, int group) {
-    LRU_time_inc(group);                  // 增加时间戳三种情况都会增加
+// 每组 e 行时默认用的 kernel。标量循环命中时能提前返回，-B 实测 E 不到 16 时
+// 它比 AVX2 快，所以只有 e >= SIMD_MIN_E 且 CPU 支持时才换成 AVX2；
+// SSE2 要拼 64 位比较，不比标量快，不做默认
+Kernel *default_kernel(int e) {
+#ifdef HAVE_X86
+    if (e >= SIMD_MIN_E && kernels[2].supported) return &kernels[2];
+#endif
+    return &kernels[0];
+}
+
+int hit_index(unsigned long tag, unsigned group) {
+    if (hash_table != NULL) return hash_find(tag, group);
+    return match_tag(tags + LINE(group, 0), sets[group].used, tag);
+}
 
+int empty_index(unsigned group) {
+    return sets[group].used < E ? sets[group].used : -1;
+}
+
+void update_cache(unsigned long tag, unsigned group) {
     int idx = hit_index(tag, group);
     if (idx != -1) {            // 命中
         if (verbose) printf("hit ");
         hit_count++;
-        cache[group][idx].time_stamp = 0;
+        LRU_unlink(group, idx);
+        LRU_push_front(group, idx);
         return;
     }
 
@@ -93,52 +277,247 @@ void update_cache(int tag, int group) {
     int empty_idx = empty_index(group), target_idx;
     if (empty_idx != -1) {  // 未命中但是有空行
         target_idx = empty_idx;
+        sets[group].used++;
     } else {  // 未命中且无空行
         if (verbose) printf("eviction ");
         eviction_count++;
         target_idx = LRU_evic_index(group);
+        LRU_unlink(group, target_idx);
+        if (hash_table != NULL) hash_remove(tags[LINE(group, target_idx)], group);
     }
-    cache[group][target_idx].valid = 1;
-    cache[group][target_idx].tag = tag;
-    cache[group][target_idx].time_stamp = 0;
+    tags[LINE(group, target_idx)] = tag;
+    if (hash_table != NULL) hash_insert(tag, group, target_idx);
+    LRU_push_front(group, target_idx);
 }
 
-void sim() {
-    FILE *fp;
-    fp = fopen(t, "r");
-    if (fp == NULL) {
-        exit(-1);
-    }
-    char op;
+#define BATCH 4096  // 解析器每次交给模拟器的访问条数
+
+// 一条 L/S/M 记录
+typedef struct access_ {
     unsigned long address;
     int size;
-    while (fscanf(fp, " %c %lx,%d", &op, &address, &size) != -1) {  // 假设都是对齐的，所以 size 没有用
-        if (verbose && op != 'I') printf("%c %lx,%d ", op, address, size);
-        int tag = address >> (s + b);
-        int group = (address & ((1 << (s + b)) - 1)) >> b;
-        // 只需要用一个 update 来模拟
-        switch (op) {
-            case 'M':
-                update_cache(tag, group);
-                update_cache(tag, group);
-                break;
-            case 'L':
-                update_cache(tag, group);
-                break;
-            case 'S':
-                update_cache(tag, group);
-                break;
-            default:
-                continue;
+    char op;
+} Access;
+
+// 解析器的状态：整个 trace 文件 mmap 进来，p 是下一条记录的开头
+const char *trace_p, *trace_end;
+
+static inline const char *skip_blank(const char *p) {
+    while (p < trace_end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+static inline const char *next_line(const char *p) {
+    const char *nl = memchr(p, '\n', trace_end - p);
+    return nl != NULL ? nl + 1 : trace_end;
+}
+
+// 从 trace 里解析出最多 max 条 L/S/M 记录，返回条数，0 表示读完了。
+// I 记录只找到行尾就跳过，不解析地址；格式不对的行也整行跳过
+int parse_batch(Access *batch, int max) {
+    const char *p = trace_p, *end = trace_end;
+    int n = 0;
+    while (n < max && p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+        if (p == end) break;
+        char op = *p++;
+        if (op != 'L' && op != 'S' && op != 'M') {
+            p = next_line(p);
+            continue;
+        }
+
+        p = skip_blank(p);
+        unsigned long address = 0;
+        const char *digits = p;
+        for (; p < end; p++) {
+            unsigned c = (unsigned char)*p, d;
+            if (c - '0' < 10) d = c - '0';
+            else if ((c | 0x20) - 'a' < 6) d = (c | 0x20) - 'a' + 10;
+            else break;
+            address = address << 4 | d;
         }
+        if (p == digits || p == end || *p != ',') {
+            p = next_line(p);
+            continue;
+        }
+        p++;
+        int size = 0;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) size = size * 10 + (*p - '0');
+
+        batch[n].op = op;
+        batch[n].address = address;
+        batch[n].size = size;
+        n++;
+        p = next_line(p);
+    }
+    trace_p = p;
+    return n;
+}
+
+// 二进制 trace（格式见 tracefmt.h）的解析状态。trace_p 指向下一个块头，
+// 当前块的记录在 [block_p, block_end)，压缩过的块先解压到 block_buf
+const unsigned char *block_p, *block_end;
+unsigned char block_buf[TRACE_BLOCK];
+trace_state_t block_state;
+unsigned long bin_records;  // 已经读出的记录数，读完后和头里的总数对一下
+
+void bad_trace(const char *why) {
+    printf("%s: corrupt binary trace (%s)\n", t, why);
+    exit(-1);
+}
+
+// 读入下一个块，没有了返回 0
+int next_block() {
+    block_hdr_t bh;
+    if (trace_p == trace_end) return 0;
+    if ((size_t)(trace_end - trace_p) < sizeof(bh)) bad_trace("truncated block header");
+    memcpy(&bh, trace_p, sizeof(bh));
+    trace_p += sizeof(bh);
+    if (bh.raw_len > TRACE_BLOCK || bh.stored_len > bh.raw_len || bh.stored_len > (size_t)(trace_end - trace_p))
+        bad_trace("bad block length");
+    const unsigned char *data = (const unsigned char *)trace_p;
+    trace_p += bh.stored_len;
+    if (bh.stored_len == bh.raw_len) {  // 没压缩的块直接在映射的内存里解码
+        block_p = data;
+    } else {
+        if (lz_decompress(data, bh.stored_len, block_buf, TRACE_BLOCK) != (int)bh.raw_len) bad_trace("bad compressed block");
+        block_p = block_buf;
+    }
+    block_end = block_p + bh.raw_len;
+    memset(&block_state, 0, sizeof(block_state));
+    return 1;
+}
+
+// 和 parse_batch 一样，只是从二进制 trace 里取记录，I 记录解码后丢掉
+int parse_bin_batch(Access *batch, int max) {
+    int n = 0, op, len;
+    unsigned long address, size;
+    while (n < max) {
+        if (block_p == block_end && !next_block()) break;
+        if ((len = trace_decode(block_p, block_end, &block_state, &op, &address, &size)) == 0) bad_trace("bad record");
+        block_p += len;
+        bin_records++;
+        if (op == TR_I) continue;
+        batch[n].op = trace_op_char(op);
+        batch[n].address = address;
+        batch[n].size = (int)size;
+        n++;
+    }
+    return n;
+}
+
+void sim_batch(const Access *batch, int n) {
+    for (int i = 0; i < n; i++) {
+        unsigned long address = batch[i].address;
+        if (verbose) printf("%c %lx,%d ", batch[i].op, address, batch[i].size);
+        unsigned long tag = address >> (s + b);
+        unsigned group = (address >> b) & (S - 1);
+        // 假设都是对齐的，所以 size 没有用；M 是一次读加一次写
+        update_cache(tag, group);
+        if (batch[i].op == 'M') update_cache(tag, group);
         if (verbose) printf("\n");
     }
-    fclose(fp);
+}
+
+void sim() {
+    int fd = open(t, O_RDONLY);
+    if (fd < 0) {
+        exit(-1);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        exit(-1);
+    }
+    size_t len = st.st_size;
+    if (len == 0) {  // 长度为 0 不能 mmap，空文件也没有记录
+        close(fd);
+        return;
+    }
+    char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("cannot mmap %s\n", t);
+        exit(-1);
+    }
+    close(fd);
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+
+    static Access batch[BATCH];
+    int n;
+    int (*parse)(Access *, int) = parse_batch;
+    trace_hdr_t hdr;
+    trace_p = map;
+    trace_end = map + len;
+    if (len >= sizeof(hdr) && memcmp(map, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {  // 二进制 trace
+        memcpy(&hdr, map, sizeof(hdr));
+        if (hdr.version != TRACE_VERSION) bad_trace("unsupported version");
+        trace_p += sizeof(hdr);
+        block_p = block_end = NULL;
+        bin_records = 0;
+        parse = parse_bin_batch;
+    }
+    while ((n = parse(batch, BATCH)) > 0) sim_batch(batch, n);
+    if (parse == parse_bin_batch && bin_records != hdr.num_records) bad_trace("record count mismatch");
+    munmap(map, len);
+}
+
+#define BENCH_RUNS 3
+
+void bench() {
+    const int bench_E[] = {1, 2, 4, 8, 16, HASH_MIN_E};  // 更大的 E 走哈希表，不比较内核
+    const int n = 1 << 22;
+    unsigned long *addrs = malloc(sizeof(unsigned long) * n);
+    if (addrs == NULL) {
+        printf("out of memory\n");
+        exit(-1);
+    }
+    s = 6;
+    b = 6;
+    verbose = 0;
+    printf("%6s", "E");
+    for (int k = 0; k < NUM_KERNELS; k++)
+        if (kernels[k].supported) printf("  %14s", kernels[k].name);
+    printf("  %8s  (M accesses/s, s=%d b=%d)\n", "default", s, b);
+
+    for (int e = 0; e < (int)(sizeof(bench_E) / sizeof(bench_E[0])); e++) {
+        E = bench_E[e];
+        unsigned long x = 88172645463325252UL, range = (2UL * E) << (s + b);
+        for (int i = 0; i < n; i++) {  // xorshift64
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            addrs[i] = x % range;
+        }
+        printf("%6d", E);
+        int ref_hits = -1;
+        for (int k = 0; k < NUM_KERNELS; k++) {
+            if (!kernels[k].supported) continue;
+            match_tag = kernels[k].fn;
+            double best = 0;
+            for (int run = 0; run < BENCH_RUNS; run++) {  // 取最快的一次
+                hit_count = miss_count = eviction_count = 0;
+                init_cache();
+                clock_t start = clock();
+                for (int i = 0; i < n; i++)
+                    update_cache(addrs[i] >> (s + b), (addrs[i] >> b) & (S - 1));
+                double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+                free_cache();
+                if (secs > 0 && n / secs > best) best = n / secs;
+            }
+            printf("  %14.1f", best / 1e6);
+            if (ref_hits == -1) ref_hits = hit_count;
+            else if (hit_count != ref_hits) printf(" (hits differ: %d vs %d)", hit_count, ref_hits);
+        }
+        printf("  %8s\n", default_kernel(E)->name);
+    }
+    free(addrs);
 }
 
 int main(int argc, char *argv[]) {
     char opt;
-    const char *optstring = "hvs:E:b:t:";
+    const char *optstring = "hvs:E:b:t:k:B";
+    probe_kernels();
+    Kernel *kernel = NULL;
+    int do_bench = 0;
     while ((opt = getopt(argc, argv, optstring)) != -1) {
         switch (opt) {
             case 'h':
@@ -159,12 +538,34 @@ int main(int argc, char *argv[]) {
             case 't':
                 strcpy(t, optarg);
                 break;
+            case 'k':
+                kernel = NULL;
+                for (int i = 0; i < NUM_KERNELS; i++)
+                    if (strcmp(optarg, kernels[i].name) == 0) kernel = &kernels[i];
+                if (kernel == NULL || !kernel->supported) {
+                    printf("kernel %s is not available\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'B':
+                do_bench = 1;
+                break;
             default:
                 printf("unknown args");
                 print_help();
                 exit(-1);
         }
     }
+    if (do_bench) {
+        bench();
+        return 0;
+    }
+    if (kernel == NULL) kernel = default_kernel(E);
+    match_tag = kernel->fn;
+    if (E < 1 || E > MAX_E) {
+        printf("-E must be between 1 and %d\n", MAX_E);
+        exit(-1);
+    }
     init_cache();
     sim();
     printSummary(hit_count, miss_count, eviction_count);
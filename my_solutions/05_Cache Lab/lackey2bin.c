@@ -0,0 +1,144 @@
+/*
+ * lackey2bin.c - Convert a valgrind lackey trace to the binary trace format
+ *
+ * usage: lackey2bin [-z] <in.trace> <out.bin>
+ *
+ *   -z  Compress each block (see tracefmt.h)
+ *
+ * csim reads the output like any text trace; it tells the formats
+ * apart by their first bytes. Lines that are not I, L, S or M records,
+ * such as the "==pid==" banner valgrind prints, are dropped, as csim
+ * would skip them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE 1024 /* max string size */
+
+static FILE *out;
+static unsigned char raw[TRACE_BLOCK];
+static unsigned char packed[TRACE_LZ_BOUND(TRACE_BLOCK)];
+static int raw_len;
+static trace_state_t state;
+
+/*
+ * app_error - Report an error and terminate
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "lackey2bin: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * flush_block - Write out the records collected so far as one block,
+ *     and start the next block from a fresh delta state
+ */
+static void flush_block(int compress)
+{
+    block_hdr_t bh;
+    unsigned char *data = raw;
+
+    if (raw_len == 0)
+	return;
+    bh.raw_len = bh.stored_len = raw_len;
+    if (compress) {
+	int n = lz_compress(raw, raw_len, packed);
+	if (n < raw_len) {
+	    bh.stored_len = n;
+	    data = packed;
+	}
+    }
+    fwrite(&bh, sizeof(bh), 1, out);
+    fwrite(data, 1, bh.stored_len, out);
+    raw_len = 0;
+    memset(&state, 0, sizeof(state));
+}
+
+/*
+ * parse_line - Parse "<op> <hex address>,<decimal size>" with optional
+ *     leading blanks. Returns 0 if the line is not a record.
+ */
+static int parse_line(const char *p, int *op, unsigned long *addr,
+		      unsigned long *size)
+{
+    const char *digits;
+    unsigned c;
+
+    while (*p == ' ' || *p == '\t')
+	p++;
+    if ((*op = trace_op_code(*p++)) < 0)
+	return 0;
+    while (*p == ' ' || *p == '\t')
+	p++;
+    *addr = 0;
+    for (digits = p; ; p++) {
+	c = (unsigned char)*p;
+	if (c - '0' < 10)
+	    *addr = *addr << 4 | (c - '0');
+	else if ((c | 0x20) - 'a' < 6)
+	    *addr = *addr << 4 | ((c | 0x20) - 'a' + 10);
+	else
+	    break;
+    }
+    if (p == digits || *p++ != ',')
+	return 0;
+    for (*size = 0; (unsigned)(*p - '0') < 10; p++)
+	*size = *size * 10 + (*p - '0');
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in;
+    trace_hdr_t hdr;
+    char line[MAXLINE];
+    char msg[MAXLINE];
+    unsigned long addr, size;
+    int op, compress = 0, arg = 1;
+
+    if (argc == 4 && strcmp(argv[1], "-z") == 0) {
+	compress = 1;
+	arg = 2;
+    }
+    if (argc - arg != 2) {
+	fprintf(stderr, "usage: %s [-z] <in.trace> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[arg], "r")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[arg]);
+	app_error(msg);
+    }
+    if ((out = fopen(argv[arg + 1], "wb")) == NULL) {
+	sprintf(msg, "Could not create %s", argv[arg + 1]);
+	app_error(msg);
+    }
+
+    /* The record count is patched in at the end */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.flags = compress ? TRACE_LZ : 0;
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    while (fgets(line, MAXLINE, in) != NULL) {
+	if (!parse_line(line, &op, &addr, &size))
+	    continue;
+	if (raw_len + TRACE_MAX_REC > TRACE_BLOCK)
+	    flush_block(compress);
+	raw_len += trace_encode(raw + raw_len, &state, op, addr, size);
+	hdr.num_records++;
+    }
+    flush_block(compress);
+
+    if (fseek(out, 0, SEEK_SET) != 0)
+	app_error("Seek failed");
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    if (fclose(out) != 0)
+	app_error("Write failed");
+    fclose(in);
+    return 0;
+}
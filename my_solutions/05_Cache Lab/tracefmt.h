@@ -0,0 +1,326 @@
+/*
+ * tracefmt.h - The binary trace format shared by csim and lackey2bin
+ *
+ * A binary trace holds the same records as a valgrind lackey trace in
+ * about a tenth of the space. It is a trace_hdr_t followed by blocks,
+ * all in host byte order. Each block is a block_hdr_t and stored_len
+ * bytes that decode to raw_len bytes of records. Without TRACE_LZ the
+ * bytes are stored as is; with it, each block is compressed on its own
+ * with the small LZ77 coder below, unless that doesn't make it smaller:
+ * a block with stored_len == raw_len is always stored as is.
+ *
+ * A record starts with a packed op/size byte:
+ *
+ *   bits 0-1  op: TR_L, TR_S, TR_M or TR_I
+ *   bits 2-5  access size, or 15 if it follows as a varint
+ *   bits 6-7  address: TR_SAME as the last record of its stream,
+ *             TR_NEXT the last address plus the last size, or
+ *             TR_DELTA a zigzag varint delta from the last address
+ *
+ * Instruction fetches and data accesses are two separate streams for
+ * the delta coding, and both start from address 0 and size 0 at the
+ * start of each block, so a block can be decoded on its own. Records
+ * never span blocks.
+ */
+#ifndef __TRACEFMT_H_
+#define __TRACEFMT_H_
+
+#include <string.h>
+
+#define TRACE_MAGIC   "CSTR" /* first four bytes of a binary trace */
+#define TRACE_VERSION 1
+#define TRACE_LZ      1      /* flag: blocks are LZ-compressed */
+
+#define TRACE_BLOCK   (64 * 1024) /* max raw bytes in a block */
+#define TRACE_MAX_REC 21          /* max bytes of one encoded record */
+
+/* Record ops, in the low two bits of the op/size byte */
+enum {TR_L, TR_S, TR_M, TR_I};
+
+/* Address modes, in the top two bits of the op/size byte */
+enum {TR_SAME, TR_NEXT, TR_DELTA};
+
+#define TR_SIZE_ESC 15 /* size field value that means "varint follows" */
+
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    unsigned int flags;
+    unsigned int pad;
+    unsigned long num_records; /* records in the whole trace */
+} trace_hdr_t;
+
+typedef struct {
+    unsigned int raw_len;      /* bytes of records in the block */
+    unsigned int stored_len;   /* bytes that follow in the file */
+} block_hdr_t;
+
+/* The delta coding state of one block */
+typedef struct {
+    unsigned long addr[2];     /* last address of the data and I streams */
+    unsigned long size[2];     /* last size of the data and I streams */
+} trace_state_t;
+
+/* Worst case size of a compressed block of n bytes */
+#define TRACE_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static inline int trace_op_code(char op)
+{
+    switch (op) {
+    case 'L': return TR_L;
+    case 'S': return TR_S;
+    case 'M': return TR_M;
+    case 'I': return TR_I;
+    default:  return -1;
+    }
+}
+
+static inline char trace_op_char(int code)
+{
+    return "LSMI"[code];
+}
+
+static inline int put_varint(unsigned char *p, unsigned long v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+	p[n++] = (unsigned char)(v | 0x80);
+	v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* Returns the bytes read, or 0 if the varint runs past end */
+static inline int get_varint(const unsigned char *p, const unsigned char *end,
+			     unsigned long *v)
+{
+    unsigned long x = 0;
+    int n = 0, shift = 0;
+
+    while (p + n < end && shift < 64) {
+	unsigned char c = p[n++];
+	x |= (unsigned long)(c & 0x7f) << shift;
+	if (!(c & 0x80)) {
+	    *v = x;
+	    return n;
+	}
+	shift += 7;
+    }
+    return 0;
+}
+
+/*
+ * trace_encode - Append one record to out; returns its length, at most
+ *     TRACE_MAX_REC
+ */
+static inline int trace_encode(unsigned char *out, trace_state_t *st,
+			       int op, unsigned long addr, unsigned long size)
+{
+    int stream = (op == TR_I), n = 1, mode;
+    unsigned long last = st->addr[stream];
+
+    if (addr == last)
+	mode = TR_SAME;
+    else if (addr == last + st->size[stream])
+	mode = TR_NEXT;
+    else
+	mode = TR_DELTA;
+    out[0] = (unsigned char)(op | (size < TR_SIZE_ESC ? size : TR_SIZE_ESC) << 2
+			     | mode << 6);
+    if (size >= TR_SIZE_ESC)
+	n += put_varint(out + n, size);
+    if (mode == TR_DELTA) {
+	long d = (long)(addr - last);
+	n += put_varint(out + n, ((unsigned long)d << 1) ^ (unsigned long)(d >> 63));
+    }
+    st->addr[stream] = addr;
+    st->size[stream] = size;
+    return n;
+}
+
+/*
+ * trace_decode - Read one record from [p, end); returns its length, or
+ *     0 if it is malformed
+ */
+static inline int trace_decode(const unsigned char *p, const unsigned char *end,
+			       trace_state_t *st, int *op, unsigned long *addr,
+			       unsigned long *size)
+{
+    int n = 1, k, stream, mode;
+    unsigned long v;
+
+    if (p >= end)
+	return 0;
+    *op = p[0] & 3;
+    stream = (*op == TR_I);
+    mode = p[0] >> 6;
+    *size = (p[0] >> 2) & 15;
+    if (*size == TR_SIZE_ESC) {
+	if ((k = get_varint(p + n, end, size)) == 0)
+	    return 0;
+	n += k;
+    }
+    switch (mode) {
+    case TR_SAME:
+	*addr = st->addr[stream];
+	break;
+    case TR_NEXT:
+	*addr = st->addr[stream] + st->size[stream];
+	break;
+    case TR_DELTA:
+	if ((k = get_varint(p + n, end, &v)) == 0)
+	    return 0;
+	n += k;
+	*addr = st->addr[stream] + ((v >> 1) ^ -(v & 1));
+	break;
+    default:
+	return 0;
+    }
+    st->addr[stream] = *addr;
+    st->size[stream] = *size;
+    return n;
+}
+
+/*
+ * The block compressor is a byte-oriented LZ77 in the style of LZ4. A
+ * block is a list of sequences, each a token byte whose high nibble is
+ * the literal count and low nibble the match length minus LZ_MIN_MATCH
+ * (15 in either means more length bytes follow, each adding up to
+ * 255), the literals, and a 2-byte little-endian match offset. The last
+ * sequence has literals only.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+
+static inline unsigned char *lz_put_len(unsigned char *q, unsigned long len)
+{
+    while (len >= 255) {
+	*q++ = 255;
+	len -= 255;
+    }
+    *q++ = (unsigned char)len;
+    return q;
+}
+
+static inline unsigned int lz_hash(const unsigned char *p)
+{
+    unsigned int x;
+
+    memcpy(&x, p, 4);
+    return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * lz_compress - Compress n <= TRACE_BLOCK bytes into out, which has room
+ *     for TRACE_LZ_BOUND(n) bytes; returns the compressed length
+ */
+static inline int lz_compress(const unsigned char *in, int n, unsigned char *out)
+{
+    int table[1 << LZ_HASH_BITS];
+    const unsigned char *p = in, *lit = in, *end = in + n, *m;
+    unsigned char *q = out, *token;
+    unsigned long len, nlit;
+    int i;
+
+    for (i = 0; i < (1 << LZ_HASH_BITS); i++)
+	table[i] = -1;
+    while (p + LZ_MIN_MATCH <= end) {
+	unsigned int h = lz_hash(p);
+	int cand = table[h];
+
+	table[h] = (int)(p - in);
+	if (cand < 0 || memcmp(in + cand, p, LZ_MIN_MATCH) != 0) {
+	    p++;
+	    continue;
+	}
+	m = in + cand;
+	for (len = LZ_MIN_MATCH; p + len < end && m[len] == p[len]; len++)
+	    ;
+
+	nlit = p - lit;
+	token = q++;
+	*token = (unsigned char)((nlit < 15 ? nlit : 15) << 4
+				 | (len - LZ_MIN_MATCH < 15 ? len - LZ_MIN_MATCH : 15));
+	if (nlit >= 15)
+	    q = lz_put_len(q, nlit - 15);
+	memcpy(q, lit, nlit);
+	q += nlit;
+	*q++ = (unsigned char)(p - m);
+	*q++ = (unsigned char)((p - m) >> 8);
+	if (len - LZ_MIN_MATCH >= 15)
+	    q = lz_put_len(q, len - LZ_MIN_MATCH - 15);
+	p += len;
+	lit = p;
+    }
+
+    nlit = end - lit;
+    token = q++;
+    *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15)
+	q = lz_put_len(q, nlit - 15);
+    memcpy(q, lit, nlit);
+    q += nlit;
+    return (int)(q - out);
+}
+
+/* Read an extended length; returns NULL if it runs past end */
+static inline const unsigned char *lz_get_len(const unsigned char *p,
+					      const unsigned char *end,
+					      unsigned long *len)
+{
+    unsigned char c;
+
+    do {
+	if (p >= end)
+	    return NULL;
+	c = *p++;
+	*len += c;
+    } while (c == 255);
+    return p;
+}
+
+/*
+ * lz_decompress - Decompress n bytes into out, which has room for cap
+ *     bytes; returns the decompressed length, or -1 if the input is
+ *     malformed
+ */
+static inline int lz_decompress(const unsigned char *in, int n,
+				unsigned char *out, int cap)
+{
+    const unsigned char *p = in, *end = in + n;
+    unsigned char *q = out, *qend = out + cap;
+    unsigned long nlit, len, off;
+    unsigned char token;
+
+    while (p < end) {
+	token = *p++;
+	nlit = token >> 4;
+	if (nlit == 15 && (p = lz_get_len(p, end, &nlit)) == NULL)
+	    return -1;
+	if (nlit > (unsigned long)(end - p) || nlit > (unsigned long)(qend - q))
+	    return -1;
+	memcpy(q, p, nlit);
+	p += nlit;
+	q += nlit;
+	if (p == end)
+	    break;  /* the last sequence has no match */
+
+	if (end - p < 2)
+	    return -1;
+	off = p[0] | p[1] << 8;
+	p += 2;
+	len = token & 15;
+	if (len == 15 && (p = lz_get_len(p, end, &len)) == NULL)
+	    return -1;
+	len += LZ_MIN_MATCH;
+	if (off == 0 || off > (unsigned long)(q - out) || len > (unsigned long)(qend - q))
+	    return -1;
+	for (; len > 0; len--, q++)  /* byte by byte: the match may overlap */
+	    *q = q[-off];
+    }
+    return (int)(q - out);
+}
+
+#endif /* __TRACEFMT_H_ */
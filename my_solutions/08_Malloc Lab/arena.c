@@ -0,0 +1,144 @@
+/*
+ * arena.c - Bump-pointer arenas on top of the mm package
+ *
+ * An arena owns a list of chunks from mm_malloc. Objects are carved
+ * out of the current chunk by bumping a pointer, so they carry no
+ * header and can't be freed one at a time. The arena record sits at
+ * the start of its first chunk, which it keeps across resets; every
+ * later chunk starts with a chunk_t that links it into the list that
+ * arena_reset walks to free them.
+ *
+ * The chunks come from mm_malloc rather than straight from mem_sbrk:
+ * the mm package assumes it owns the whole heap between the prologue
+ * and the epilogue, and an arena growing the heap under it would break
+ * that. Chunks of at least mm_mmap_threshold bytes come from mem_map.
+ */
+#include <stdint.h>
+
+#include "arena.h"
+#include "mm.h"
+
+#define ARENA_ALIGN 8 /* alignment of arena_alloc, like mm_malloc */
+
+/* Round p up to a multiple of align, a power of two */
+#define ALIGN_UP(p, align) \
+    ((char *)(((uintptr_t)(p) + (align) - 1) & ~(uintptr_t)((align) - 1)))
+
+/* The object area of the first chunk, right after the arena record */
+#define FIRST_PTR(a) ((char *)((a) + 1))
+#define FIRST_END(a) (FIRST_PTR(a) + (a)->chunk_size)
+
+/* Header of every chunk but the first */
+typedef struct chunk {
+    struct chunk *next;  /* the chunk allocated before this one */
+} chunk_t;
+
+struct arena {
+    char *ptr;           /* next free byte in the current chunk */
+    char *end;           /* end of the current chunk */
+    chunk_t *chunks;     /* chunks after the first, newest first */
+    size_t chunk_size;   /* object bytes of a regular chunk */
+};
+
+static void *new_chunk(arena_t *a, size_t align, size_t size);
+
+/*
+ * arena_create - Make an empty arena, with its first chunk
+ */
+arena_t *arena_create(size_t chunk_size)
+{
+    arena_t *a;
+
+    if (chunk_size == 0)
+	chunk_size = ARENA_CHUNK;
+    if ((a = mm_malloc(sizeof(arena_t) + chunk_size)) == NULL)
+	return NULL;
+    a->chunks = NULL;
+    a->chunk_size = chunk_size;
+    a->ptr = FIRST_PTR(a);
+    a->end = FIRST_END(a);
+    return a;
+}
+
+/*
+ * arena_alloc - Bump-allocate size bytes aligned to ARENA_ALIGN
+ */
+void *arena_alloc(arena_t *a, size_t size)
+{
+    return arena_memalign(a, ARENA_ALIGN, size);
+}
+
+/*
+ * arena_memalign - Bump-allocate size bytes aligned to align
+ */
+void *arena_memalign(arena_t *a, size_t align, size_t size)
+{
+    char *p;
+
+    if (size == 0 || (align & (align - 1)))
+	return NULL;
+    if (align < ARENA_ALIGN)
+	align = ARENA_ALIGN;
+
+    p = ALIGN_UP(a->ptr, align);
+    if (p > a->end || size > (size_t)(a->end - p))
+	return new_chunk(a, align, size);
+    a->ptr = p + size;
+    return p;
+}
+
+/*
+ * new_chunk - Serve a request that doesn't fit in the current chunk. A
+ *     request bigger than a quarter chunk gets a chunk of its own and
+ *     leaves the current one to the requests after it; any other
+ *     request starts a new current chunk.
+ */
+static void *new_chunk(arena_t *a, size_t align, size_t size)
+{
+    chunk_t *c;
+    size_t len;
+    char *p;
+    int own;
+
+    if (size > (size_t)-1 - sizeof(chunk_t) - align)
+	return NULL;
+    own = (size + align > a->chunk_size / 4);
+    len = own ? size + align : a->chunk_size;
+    if ((c = mm_malloc(sizeof(chunk_t) + len)) == NULL)
+	return NULL;
+    c->next = a->chunks;
+    a->chunks = c;
+
+    /* At most align - 1 bytes of padding, so the object fits in len */
+    p = ALIGN_UP(c + 1, align);
+    if (!own) {
+	a->ptr = p + size;
+	a->end = (char *)(c + 1) + len;
+    }
+    return p;
+}
+
+/*
+ * arena_reset - Free every chunk but the first and start over in it
+ */
+void arena_reset(arena_t *a)
+{
+    chunk_t *c, *next;
+
+    for (c = a->chunks; c != NULL; c = next) {
+	next = c->next;
+	mm_free(c);
+    }
+    a->chunks = NULL;
+    a->ptr = FIRST_PTR(a);
+    a->end = FIRST_END(a);
+}
+
+/*
+ * arena_destroy - Free every chunk, the first one with the arena record
+ */
+void arena_destroy(arena_t *a)
+{
+    arena_reset(a);
+    mm_free(a);
+}
@@ -0,0 +1,43 @@
+/*
+ * arena.h - Bump-pointer arenas on top of the mm package
+ *
+ * An arena hands out objects that are freed all at once: arena_alloc
+ * carves them out of big chunks from mm_malloc by bumping a pointer,
+ * with no per-object header, and arena_reset frees every one of them
+ * in time proportional to the number of chunks. An arena is not safe
+ * to use from several threads at once.
+ */
+#ifndef __ARENA_H_
+#define __ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_CHUNK (64 * 1024) /* default chunk size in bytes */
+
+typedef struct arena arena_t;
+
+/*
+ * arena_create - Make an empty arena that grows chunk_size bytes at a
+ *     time (ARENA_CHUNK if 0). Returns NULL if mm_malloc fails.
+ */
+arena_t *arena_create(size_t chunk_size);
+
+/*
+ * arena_alloc - Return size bytes aligned to 8, or NULL if size is 0
+ *     or mm_malloc fails
+ */
+void *arena_alloc(arena_t *a, size_t size);
+
+/*
+ * arena_memalign - Like arena_alloc, aligned to align bytes, which must
+ *     be a power of two
+ */
+void *arena_memalign(arena_t *a, size_t align, size_t size);
+
+/* Free every object in the arena; the arena keeps its first chunk */
+void arena_reset(arena_t *a);
+
+/* Free every object and the arena itself */
+void arena_destroy(arena_t *a);
+
+#endif /* __ARENA_H_ */
@@ -58,7 +58,7 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes (mdriver -s sets mem_max_heap)
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
@@ -67,6 +67,7 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_PERF   1   /* clock_gettime, plus hardware event counts on Linux */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,186 @@
+/*
+ * fperf.c - Time a function f while counting hardware events
+ *
+ * The events are opened once, as a single perf_event_open(2) group on
+ * the calling thread, so that they are started, stopped and read
+ * together. Only user-mode events are counted, which an unprivileged
+ * process may do at the default perf_event_paranoid setting. Events the
+ * CPU lacks are left out of the group; if even the cycle counter can't
+ * be opened (no PMU, a VM, a seccomp filter, not Linux), ftimer_perf
+ * still times f and reports every count as -1.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "fperf.h"
+
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* The perf event type and config of each FPERF_ event */
+static const uint64_t event_config[FPERF_NUM] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int group_fd = -1;         /* the leader, -1 if no counters */
+static int member_fd[FPERF_NUM];  /* the other events, -1 if not open */
+static int slot[FPERF_NUM];       /* position of each event in a group
+				     read, -1 if it isn't in the group */
+static int num_events = 0;        /* events in the group */
+#endif
+
+static char errbuf[128];          /* why the counters are unavailable */
+static int initialized = 0;
+
+#ifdef __linux__
+/*
+ * open_event - Open one user-mode hardware event on this thread, as
+ * a member of group (or as the leader if group is -1)
+ */
+static int open_event(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group == -1);  /* the leader starts the whole group */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP |
+	PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/*
+ * init_fperf - Open the counters. Returns the number of events that can
+ *     be counted, 0 if the kernel or CPU offers none
+ */
+int init_fperf(void)
+{
+#ifdef __linux__
+    int i, fd;
+
+    if (initialized)
+	return num_events;
+    initialized = 1;
+    for (i = 0; i < FPERF_NUM; i++)
+	member_fd[i] = -1;
+
+    if ((group_fd = open_event(event_config[FPERF_CYCLES], -1)) < 0) {
+	sprintf(errbuf, "perf_event_open: %s", strerror(errno));
+	return 0;
+    }
+    slot[FPERF_CYCLES] = num_events++;
+    for (i = FPERF_CYCLES + 1; i < FPERF_NUM; i++) {
+	/* The members are only ever read through the leader */
+	if ((fd = open_event(event_config[i], group_fd)) < 0)
+	    slot[i] = -1;
+	else {
+	    member_fd[i] = fd;
+	    slot[i] = num_events++;
+	}
+    }
+    return num_events;
+#else
+    initialized = 1;
+    strcpy(errbuf, "hardware counters need Linux perf_event_open");
+    return 0;
+#endif
+}
+
+/*
+ * reopen_fperf - Close the counters and open them again on the calling
+ *     thread. A forked child must call it before timing anything: the
+ *     counters it inherits count its parent, not itself.
+ */
+int reopen_fperf(void)
+{
+#ifdef __linux__
+    int i;
+
+    if (initialized) {
+	for (i = 0; i < FPERF_NUM; i++)
+	    if (member_fd[i] >= 0)
+		close(member_fd[i]);
+	if (group_fd >= 0)
+	    close(group_fd);
+	group_fd = -1;
+	num_events = 0;
+    }
+#endif
+    initialized = 0;
+    errbuf[0] = '\0';
+    return init_fperf();
+}
+
+/*
+ * fperf_error - Why init_fperf could not open the counters, or NULL
+ */
+char *fperf_error(void)
+{
+    return errbuf[0] ? errbuf : NULL;
+}
+
+/*
+ * ftimer_perf - Estimate the running time of f(argp) using
+ *     clock_gettime. Return the average of n runs, with the average
+ *     event counts per run in counts[] (-1 if an event wasn't counted)
+ */
+double ftimer_perf(fperf_test_funct f, void *argp, int n, double *counts)
+{
+    struct timespec start, end;
+    double diff;
+    int i;
+#ifdef __linux__
+    /* nr, time_enabled and time_running, then one value per event */
+    uint64_t buf[3 + FPERF_NUM];
+    double scale;
+#endif
+
+    if (!initialized)
+	init_fperf();
+    for (i = 0; i < FPERF_NUM; i++)
+	counts[i] = -1;
+
+#ifdef __linux__
+    if (group_fd >= 0) {
+	ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++)
+	f(argp);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+#ifdef __linux__
+    if (group_fd >= 0) {
+	ioctl(group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	/*
+	 * If the PMU was shared with other events, the group only ran
+	 * part of the time; scale the counts up to the whole interval
+	 */
+	if (read(group_fd, buf, sizeof(buf)) >= (ssize_t)(3 * sizeof(uint64_t))
+	    && buf[0] == (uint64_t)num_events && buf[2] > 0) {
+	    scale = (double)buf[1] / buf[2];
+	    for (i = 0; i < FPERF_NUM; i++)
+		if (slot[i] >= 0)
+		    counts[i] = buf[3 + slot[i]] * scale / n;
+	}
+    }
+#endif
+
+    diff = (end.tv_sec - start.tv_sec) + 1E-9 * (end.tv_nsec - start.tv_nsec);
+    return diff / n;
+}
@@ -0,0 +1,38 @@
+/*
+ * fperf.h - prototypes for the routines in fperf.c that time a test
+ *     function f while reading the CPU's hardware event counters
+ */
+#ifndef __FPERF_H_
+#define __FPERF_H_
+
+/* The hardware events counted around each measurement */
+enum {FPERF_CYCLES, FPERF_INSTRS, FPERF_CACHE_MISSES, FPERF_BRANCH_MISSES,
+      FPERF_NUM};
+
+/* The test function takes a generic pointer as input */
+typedef void (*fperf_test_funct)(void *);
+
+/*
+ * init_fperf - Open the counters. Returns the number of events that can
+ *     be counted, 0 if the kernel or CPU offers none (see fperf_error)
+ */
+int init_fperf(void);
+
+/*
+ * reopen_fperf - Open the counters again on the calling thread, e.g. in
+ *     a forked child, whose inherited counters count the parent
+ */
+int reopen_fperf(void);
+
+/* Why init_fperf could not open the counters, or NULL if it could */
+char *fperf_error(void);
+
+/*
+ * ftimer_perf - Estimate the running time of f(argp) using
+ *     clock_gettime. Return the average of n runs, and store the
+ *     average event counts per run in counts[], with -1 for each event
+ *     that could not be counted. Works without counters, too.
+ */
+double ftimer_perf(fperf_test_funct f, void *argp, int n, double *counts);
+
+#endif /* __FPERF_H_ */
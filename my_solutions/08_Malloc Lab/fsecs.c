@@ -6,9 +6,12 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fperf.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static double counts[FPERF_NUM]; /* event counts of the last fsecs call */
+static int have_counts = 0;      /* were they measured at all? */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +39,26 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_PERF
+    if (init_fperf() > 0) {
+	if (verbose)
+	    printf("Measuring performance with clock_gettime() and hardware counters.\n");
+    }
+    else if (verbose)
+	printf("Measuring performance with clock_gettime() (no hardware counters: %s).\n",
+	       fperf_error());
+#endif
+}
+
+/*
+ * reinit_fsecs - Redo the per-process setup in a forked child, so that
+ *     its measurements count the child rather than its parent
+ */
+void reinit_fsecs(void)
+{
+#if USE_PERF
+    reopen_fperf();
+    have_counts = 0;
 #endif
 }
 
@@ -51,7 +74,24 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_PERF
+    double secs = ftimer_perf(f, argp, 10, counts);
+    have_counts = (counts[FPERF_CYCLES] >= 0);
+    return secs;
 #endif 
 }
 
+/*
+ * fsecs_counts - Copy the hardware event counts per run of the last
+ *     fsecs call into c[FPERF_NUM]. Returns 0 if nothing was counted.
+ */
+int fsecs_counts(double *c)
+{
+    int i;
+
+    for (i = 0; i < FPERF_NUM; i++)
+	c[i] = have_counts ? counts[i] : -1;
+    return have_counts;
+}
+
 
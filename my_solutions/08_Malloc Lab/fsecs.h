@@ -1,4 +1,6 @@
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
+void reinit_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+int fsecs_counts(double *c);
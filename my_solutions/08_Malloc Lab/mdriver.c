@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -15,11 +16,21 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <fcntl.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fperf.h"
+#include "arena.h"
 #include "config.h"
+#include "tracefmt.h"
 
 /**********************
  * Constants and macros
@@ -29,28 +40,34 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define RANGE_CHUNK 4096 /* range records allocated from the pool at a time */
+#define MAX_HEAP_MB 4095 /* mm addresses its heap with 32-bit offsets */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
+/* The alignment a request asks for: 2^align for memalign, else ALIGNMENT */
+#define OP_ALIGN(op) ((op).type == MEMALIGN && (1 << (op).align) > ALIGNMENT ? \
+		      1 << (op).align : ALIGNMENT)
+
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form a treap
+ * ordered by lo, so overlap checks and removals take O(log n).
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* records with smaller lo */
+    struct range_t *right; /* records with larger lo; free list link */
+    unsigned int prio;     /* heap-ordered random priority */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     int sugg_heapsize;   /* suggested heap size (unused) */
@@ -60,6 +77,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file, ops points in */
+    size_t map_len;      /* length of that mapping, 0 for .rep traces */
 } trace_t;
 
 /* 
@@ -72,6 +91,14 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* Holds the params and outcome of one replay thread in the -T mode */
+typedef struct {
+    trace_t *trace;  /* shared trace; only its ops array is read */
+    char **blocks;   /* this thread's own block pointers, one per id */
+    int tag;         /* byte this thread stamps into its payloads */
+    enum {REPLAY_OK, REPLAY_NOMEM, REPLAY_CLOBBERED} status;
+} replay_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,10 +108,28 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak;     /* largest heap size while running the trace */
+    size_t resident; /* heap bytes backed by physical pages at the end */
+
+    /* hardware event counts per run of the trace, -1 if not counted */
+    double hw[FPERF_NUM];
 
-    /* Note: secs and util are only defined if valid is true */
+    /* Note: secs, util and hw are only defined if valid is true */
 } stats_t; 
 
+/* A worker process evaluating one trace in the -j mode */
+typedef struct {
+    pid_t pid;       /* 0 if the slot is free */
+    int tracenum;    /* the trace it is evaluating */
+    int fd;          /* read end of the pipe it sends its result_t on */
+} worker_t;
+
+/* What a worker sends back to the driver when it is done */
+typedef struct {
+    stats_t stats;   /* the stats for its trace */
+    int errors;      /* errors it found */
+} result_t;
+
 /********************
  * Global variables
  *******************/
@@ -95,6 +140,29 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Names of the mm functions behind each request type, for error messages */
+static char *op_names[] = {"mm_malloc", "mm_free", "mm_realloc", "mm_calloc",
+			   "mm_memalign", "arena_reset"};
+
+/* Names of the mm placement policies, indexed by mm_fit (-P) */
+static char *fit_names[MM_NUM_FITS] = {"first", "next", "best", "good"};
+
+/* Fragmentation report (-H): sample interval in ops and the open CSV */
+static int frag_interval = 0;
+static FILE *frag_csv = NULL;
+
+/* Check the heap with mm_checkheap every n ops of the correctness pass (-c) */
+static int check_interval = 0;
+
+/* Parallel evaluation (-j): number of workers and CPUs to pin them to (-C) */
+static int num_jobs = 1;
+static int *pin_cpus = NULL;
+static int num_pin_cpus = 0;
+
+/* Arena mode (-A): the blocks of the trace being replayed come from arena */
+static int use_arena = 0;
+static arena_t *arena = NULL;
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
@@ -105,28 +173,64 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+/* these functions manipulate range trees */
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_alloc(void);
+static range_t *range_insert(range_t *root, range_t *r);
+static range_t *range_delete(range_t *root, char *lo);
+static void range_release(range_t *root);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void read_rep_trace(trace_t *trace, char *path);
+static int read_bin_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static char *libc_alloc_op(traceop_t *op);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_arena_speed(void *ptr);
+static void check_arena_trace(char *tracefile);
+static int init_mm(void);
+static char *mm_alloc_op(traceop_t *op);
+static char *mm_realloc_op(char *oldp, size_t oldsize, size_t size);
+
+/* Routines for evaluating mm on every trace and comparing policies (-P) */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges);
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats);
+static int parse_fit(char *name);
+static void printfrontier(char **tracefiles, int n);
+
+/* Routines for the fragmentation report (-H) */
+static FILE *open_frag_csv(char *tracefile);
+static void frag_sample(int opnum, size_t payload);
+
+/* Routines for measuring how mm scales across threads (-T) */
+static void *replay_thread(void *vargp);
+static double eval_mm_scaling(trace_t *trace, int nthreads, int *status);
+static void printscaling(int tracenum, trace_t *trace, int maxthreads);
+
+/* Routines for evaluating traces in parallel worker processes (-j) */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats);
+static int parse_cpus(char *list);
+static void pin_cpu(int cpu);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static int parse_size(char *arg, size_t *n);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -142,7 +246,6 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,15 +253,18 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int maxthreads = 0;  /* If set, only measure thread scaling (-T) */
+    int frontier = 0;    /* If set, compare all placement policies (-P all) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
     int numcorrect;
+    int mb;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:m:P:T:r:M:D:H:j:C:c:s:hvVgalSA")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,6 +284,92 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'm': /* Free block organization used by mm.c */
+            if (!strcmp(optarg, "implicit"))
+                mm_freelist = MM_IMPLICIT;
+            else if (!strcmp(optarg, "seglist"))
+                mm_freelist = MM_SEGLIST;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Placement policy used by mm.c, or all of them */
+            if (!strcmp(optarg, "all"))
+                frontier = 1;
+            else if (parse_fit(optarg) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Replay each trace on 1, 2, 4, ... maxthreads threads */
+            maxthreads = atoi(optarg);
+            if (maxthreads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'r': /* Release free spans of at least this many bytes */
+            if (parse_size(optarg, &mm_release_threshold) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'M': /* Map requests of at least this many bytes (0: never) */
+            if (parse_size(optarg, &mm_mmap_threshold) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'D': /* Defer coalescing until n bytes of small blocks wait */
+            if (parse_size(optarg, &mm_defer_limit) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Sample heap fragmentation every n ops into CSV files */
+            frag_interval = atoi(optarg);
+            if (frag_interval < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'c': /* Run mm_checkheap every n ops (0: never, 1: every op) */
+            check_interval = atoi(optarg);
+            if (check_interval < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Evaluate up to n traces at once (0: one per CPU) */
+            num_jobs = atoi(optarg);
+            if (num_jobs == 0)
+                num_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            if (num_jobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'C': /* Pin the evaluation to these CPUs, e.g. "2,3,6-9" */
+            if (parse_cpus(optarg) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 's': /* Let the simulated heap grow to n MB */
+            mb = atoi(optarg);
+            if (mb < 1 || mb > MAX_HEAP_MB) {
+                usage();
+                exit(1);
+            }
+            mem_max_heap = (size_t)mb << 20;
+            break;
+        case 'S': /* Don't use the slab allocator for small requests */
+            mm_slab = 0;
+            break;
+        case 'A': /* Allocate from an arena, reset at each EPOCH */
+            use_arena = 1;
+            break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
@@ -235,9 +427,48 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* An arena frees nothing before an EPOCH, so -A needs traces with them */
+    if (use_arena)
+	for (i = 0; i < num_tracefiles; i++)
+	    check_arena_trace(tracefiles[i]);
+
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Without workers, -C pins the driver itself */
+    if (num_pin_cpus && num_jobs <= 1)
+	pin_cpu(pin_cpus[0]);
+
+    /* Workers sharing a core time each other, not just the mm package */
+    if (num_jobs > 1 && (num_pin_cpus ? num_pin_cpus :
+			 sysconf(_SC_NPROCESSORS_ONLN)) < num_jobs)
+	printf("Warning: %d jobs on fewer cores; throughput is not comparable "
+	       "to a -j 1 run\n", num_jobs);
+
+    /*
+     * In -T mode, only measure how the mm package scales across threads
+     */
+    if (maxthreads) {
+	if (use_arena) {  /* an arena serves one thread */
+	    usage();
+	    exit(1);
+	}
+	mm_concurrent = 1;
+	mem_init();
+	printf("\nScaling of mm malloc (%s free list):\n",
+	       mm_freelist == MM_IMPLICIT ? "implicit" : "seglist");
+	printf("%5s%8s%9s%10s%7s%8s\n",
+	       "trace", "threads", "ops", "secs", "Kops", "speedup");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    printscaling(i, trace, maxthreads);
+	    free_trace(trace);
+	}
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -262,6 +493,7 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		fsecs_counts(libc_stats[i].hw);
 	    }
 	    free_trace(trace);
 	}
@@ -277,7 +509,9 @@ int main(int argc, char **argv)
      * Always run and evaluate the student's mm package
      */
     if (verbose > 1)
-	printf("\nTesting mm malloc\n");
+	printf("\nTesting mm malloc (%s free list%s)\n",
+	       mm_freelist == MM_IMPLICIT ? "implicit" : "seglist",
+	       use_arena ? ", arena" : "");
 
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
@@ -287,29 +521,24 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    /* 
+     * With -P all, compare every placement policy instead of scoring one
+     */
+    if (frontier) {
+	printfrontier(tracefiles, num_tracefiles);
+	if (errors)
+	    printf("Terminated with %d errors\n", errors);
+	exit(0);
     }
 
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    eval_mm_traces(tracefiles, num_tracefiles, mm_stats);
+
     /* Display the mm results in a compact table */
     if (verbose) {
-	printf("\nResults for mm malloc:\n");
+	printf("\nResults for mm malloc (%s free list%s):\n",
+	       mm_freelist == MM_IMPLICIT ? "implicit" : "seglist",
+	       use_arena ? ", arena" : "");
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
@@ -367,64 +596,81 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Records come
+ * from a pool that grows RANGE_CHUNK records at a time and is never
+ * returned to libc, so the validator makes no malloc calls of its own
+ * once the pool has warmed up.
  ****************************************************************/
 
+static range_t *range_free = NULL;   /* pool of unused range records */
+static unsigned int range_seed = 1;  /* xorshift state for priorities */
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     size bytes at addr lo, which must be aligned to align bytes. After
+ *     checking the block for correctness, we create a range struct for
+ *     this block and add it to the range tree. 
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(range_t **ranges, char *lo, int size, int align,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred;
     char msg[MAXLINE];
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be ALIGNMENT-byte aligned, or more for memalign */
+    if (!IS_ALIGNED(lo) || (unsigned long)lo % align != 0) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
-		lo, ALIGNMENT);
+		lo, align);
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
-	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
+    /* The payload must lie within the extent of the heap, or within
+       one of the regions that the package mapped with mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_in_map(lo, hi)) {
+	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p) and mapped regions",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
+    /* 
+     * The payload must not overlap any other payloads. The recorded
+     * payloads are disjoint, so only the one with the largest lo not
+     * above hi can overlap [lo, hi].
+     */
+    pred = NULL;
+    for (p = *ranges;  p != NULL; ) {
+        if (p->lo <= hi) {
+            pred = p;
+            p = p->right;
         }
+        else
+            p = p->left;
+    }
+    if (pred != NULL && pred->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, pred->lo, pred->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_alloc();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -432,35 +678,133 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo 
  */
 static void remove_range(range_t **ranges, char *lo)
+{
+    *ranges = range_delete(*ranges, lo);
+}
+
+/*
+ * clear_ranges - return all of the range records for a trace to the pool
+ */
+static void clear_ranges(range_t **ranges)
+{
+    range_release(*ranges);
+    *ranges = NULL;
+}
+
+/*
+ * range_alloc - Take a record from the pool, refilling it from libc
+ *     when it runs dry. The record gets a fresh random priority.
+ */
+static range_t *range_alloc(void)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    int i;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (range_free == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in range_alloc");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].right = range_free;
+	    range_free = &p[i];
+	}
     }
+    p = range_free;
+    range_free = p->right;
+
+    range_seed ^= range_seed << 13;
+    range_seed ^= range_seed >> 17;
+    range_seed ^= range_seed << 5;
+    p->prio = range_seed;
+    p->left = p->right = NULL;
+    return p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * range_insert - Insert record r into the treap rooted at root and
+ *     return the new root
  */
-static void clear_ranges(range_t **ranges)
+static range_t *range_insert(range_t *root, range_t *r)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *c;
+
+    if (root == NULL)
+	return r;
+    if (r->lo < root->lo) {
+	root->left = range_insert(root->left, r);
+	if (root->left->prio > root->prio) { /* rotate right */
+	    c = root->left;
+	    root->left = c->right;
+	    c->right = root;
+	    return c;
+	}
+    }
+    else {
+	root->right = range_insert(root->right, r);
+	if (root->right->prio > root->prio) { /* rotate left */
+	    c = root->right;
+	    root->right = c->left;
+	    c->left = root;
+	    return c;
+	}
+    }
+    return root;
+}
+
+/*
+ * range_delete - Remove the record whose payload starts at lo from the
+ *     treap rooted at root, return it to the pool, and return the new root
+ */
+static range_t *range_delete(range_t *root, char *lo)
+{
+    range_t *l, *r, **link;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    if (root == NULL)
+	return NULL;
+    if (lo < root->lo) {
+	root->left = range_delete(root->left, lo);
+	return root;
+    }
+    if (lo > root->lo) {
+	root->right = range_delete(root->right, lo);
+	return root;
+    }
+
+    /* Merge the two subtrees in priority order to replace root */
+    l = root->left;
+    r = root->right;
+    root->right = range_free;
+    range_free = root;
+    for (link = &root; l != NULL && r != NULL; ) {
+	if (l->prio > r->prio) {
+	    *link = l;
+	    link = &l->right;
+	    l = l->right;
+	}
+	else {
+	    *link = r;
+	    link = &r->left;
+	    r = r->left;
+	}
+    }
+    *link = (l != NULL) ? l : r;
+    return root;
+}
+
+/*
+ * range_release - Return every record of the treap rooted at root to
+ *     the pool
+ */
+static void range_release(range_t *root)
+{
+    range_t *next;
+
+    while (root != NULL) {
+	range_release(root->left);
+	next = root->right;
+	root->right = range_free;
+	range_free = root;
+	root = next;
     }
-    *ranges = NULL;
 }
 
 
@@ -469,17 +813,13 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     (see tracefmt.h) are mapped rather than parsed.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -488,9 +828,44 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
 	
-    /* Read the trace file header */
+    /* Fill in the header fields and the ops array */
     strcpy(path, tracedir);
     strcat(path, filename);
+    trace->map = NULL;
+    trace->map_len = 0;
+    if (!read_bin_trace(trace, path))
+	read_rep_trace(trace, path);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+    
+    return trace;
+}
+
+/*
+ * read_rep_trace - parse the text trace file at path into trace. An "e"
+ *     line becomes an EPOCH op followed by a FREE op for every block
+ *     still allocated (see tracefmt.h).
+ */
+static void read_rep_trace(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    unsigned index, size, align;
+    unsigned max_index = 0;
+    unsigned op_index, max_ops, lines, need;
+    trace_live_t live;
+    traceop_t *op;
+    int lg;
+
+    /* Read the trace file header */
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
@@ -500,67 +875,196 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fscanf(tracefile, "%d", &(trace->num_ops));     
     fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
+    /* We'll store each request line in the trace in this array, which
+       grows when "e" lines expand into more ops than there are lines */
+    max_ops = trace->num_ops > 0 ? trace->num_ops : 1;
     if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	 (traceop_t *)malloc(max_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
+    if (trace_live_init(&live, trace->num_ids) < 0)
+	unix_error("malloc failed in read_rep_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
     /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
+    index = size = 0;
+    op_index = lines = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+	need = (type[0] == 'e') ? live.n + 1 : 1;
+	if (op_index + need > max_ops) {
+	    while (op_index + need > max_ops)
+		max_ops *= 2;
+	    if ((trace->ops = (traceop_t *)realloc(trace->ops,
+			max_ops * sizeof(traceop_t))) == NULL)
+		unix_error("realloc failed in read_rep_trace");
+	}
+	op = &trace->ops[op_index];
+	op->align = 0;
 	switch(type[0]) {
 	case 'a':
 	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
+	    op->type = ALLOC;
+	    op->index = index;
+	    op->size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
 	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
+	    op->type = REALLOC;
+	    op->index = index;
+	    op->size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    op->type = CALLOC;
+	    op->index = index;
+	    op->size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &size, &align);
+	    if ((lg = trace_align_log2(align)) < 0) {
+		printf("Bad alignment (%u) in tracefile %s\n", align, path);
+		exit(1);
+	    }
+	    op->type = MEMALIGN;
+	    op->index = index;
+	    op->size = size;
+	    op->align = lg;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
+	    op->type = FREE;
+	    op->index = index;
+	    size = 0;
+	    break;
+	case 'e':
+	    op->type = EPOCH;
+	    op->index = 0;
+	    op->size = 0;
+	    while (live.n > 0) {
+		op = &trace->ops[++op_index];
+		op->type = FREE;
+		op->index = live.ids[live.n - 1];
+		op->size = 0;
+		op->align = 0;
+		trace_live_op(&live, FREE, op->index);
+	    }
+	    size = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
 	    exit(1);
 	}
+	if (size > TRACE_MAX_SIZE) {
+	    printf("Request of %u bytes in tracefile %s is too large\n",
+		   size, path);
+	    exit(1);
+	}
+	if (type[0] != 'e' && trace_live_op(&live, op->type, index) < 0) {
+	    printf("Bad use of block id %u in tracefile %s\n", index, path);
+	    exit(1);
+	}
 	op_index++;
-	
+	lines++;
     }
     fclose(tracefile);
+    trace_live_free(&live);
     assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    assert(trace->num_ops == lines);
+    trace->num_ops = op_index;
+}
+
+/*
+ * read_bin_trace - If the file at path is a binary trace, map it, point
+ *     trace->ops at its records and fill in the header fields. Returns 0
+ *     without touching trace if the file is not a binary trace.
+ */
+static int read_bin_trace(trace_t *trace, char *path)
+{
+    int fd, i;
+    struct stat st;
+    trace_hdr_t *hdr;
+    traceop_t *ops;
+    trace_live_t live;
+    char *map;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in read_bin_trace");
+    if (st.st_size < (off_t)sizeof(trace_hdr_t)) {
+	close(fd);
+	return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	unix_error("mmap failed in read_bin_trace");
+    hdr = (trace_hdr_t *)map;
+    if (memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0) {
+	munmap(map, st.st_size);
+	return 0;
+    }
+
+    if (hdr->version < TRACE_MIN_VERSION || hdr->version > TRACE_VERSION) {
+	printf("Tracefile %s has binary format version %u, not %d; "
+	       "convert it again with rep2bin\n", path, hdr->version, TRACE_VERSION);
+	exit(1);
+    }
+    if (hdr->num_ops < 0 || hdr->num_ids < 0 ||
+	(size_t)st.st_size != sizeof(trace_hdr_t) + 
+	(size_t)hdr->num_ops * sizeof(traceop_t)) {
+	printf("Bad binary trace header in tracefile %s\n", path);
+	exit(1);
+    }
+
+    /* The replay loops read the ops front to back */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    /* 
+     * Check the ops the way read_rep_trace checks a .rep file, so that a
+     * corrupt or stale file is rejected here instead of indexing past
+     * the blocks array during the replay
+     */
+    ops = (traceop_t *)(map + sizeof(trace_hdr_t));
+    if (trace_live_init(&live, hdr->num_ids) < 0)
+	unix_error("malloc failed in read_bin_trace");
+    for (i = 0; i < hdr->num_ops; i++) {
+	if (ops[i].type > EPOCH ||
+	    (ops[i].type != EPOCH &&
+	     trace_live_op(&live, ops[i].type, ops[i].index) < 0)) {
+	    printf("Bad binary trace %s: bad type or block id in op %d\n",
+		   path, i);
+	    exit(1);
+	}
+    }
+    trace_live_free(&live);
+
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = ops;
+    trace->map = map;
+    trace->map_len = st.st_size;
+    return 1;
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(). The
+ *              ops of a binary trace are unmapped instead.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -584,12 +1088,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree. Zeroing
+       the heap lets mm_calloc use memory that has never been touched. */
     mem_reset_brk();
+    mem_release(mem_heap_lo(), mem_max_heap);
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (init_mm() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -602,20 +1108,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
+		sprintf(msg, "%s failed.", arena != NULL ? "arena_alloc" :
+			op_names[trace->ops[i].type]);
+		malloc_error(tracenum, i, msg);
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
+	    if (add_range(ranges, p, size, OP_ALIGN(trace->ops[i]),
+			  tracenum, i) == 0)
 		return 0;
+
+	    /* A calloc'd block must come back zeroed */
+	    if (trace->ops[i].type == CALLOC) {
+		for (j = 0; j < size && p[j] == 0; j++)
+		    ;
+		if (j < size) {
+		    malloc_error(tracenum, i, "mm_calloc did not zero the block");
+		    return 0;
+		}
+	    }
 	    
 	    /* ADDED: cgw
 	     * fill range with low byte of index.  This will be used later
@@ -633,16 +1154,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
+	    if ((newp = mm_realloc_op(oldp, trace->block_sizes[index],
+				      size)) == NULL) {
+		malloc_error(tracenum, i, arena != NULL ? "arena_alloc failed." :
+			     "mm_realloc failed.");
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
+	    /* Remove the old region from the range tree; an arena
+	       keeps it until the next EPOCH */
+	    if (arena == NULL)
+		remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
+	    /* Check new block for correctness and add it to range tree */
+	    if (add_range(ranges, newp, size, ALIGNMENT, tracenum, i) == 0)
 		return 0;
 	    
 	    /* ADDED: cgw
@@ -653,7 +1178,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -669,15 +1194,30 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case FREE: /* mm_free */
 	    
 	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (arena == NULL) {
+		p = trace->blocks[index];
+		remove_range(ranges, p);
+		mm_free(p);
+	    }
+	    break;
+
+	case EPOCH: /* arena_reset; mm gets the FREE ops that follow */
+	    if (arena != NULL) {
+		arena_reset(arena);
+		clear_ranges(ranges);
+	    }
 	    break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* Catch heap corruption near the op that caused it */
+	if (check_interval && (i + 1) % check_interval == 0 &&
+	    mm_checkheap(0) != 0) {
+	    malloc_error(tracenum, i, "mm_checkheap found an inconsistent heap.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -689,35 +1229,42 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
- *   
+ *   high water mark of the heap size in bytes while running the
+ *   student's malloc package on the trace. mem_sbrk() lets the package
+ *   shrink the heap, so the final brk can be lower than the peak; both
+ *   the peak and the resident part of the final heap go into *stats.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+			   stats_t *stats)
 {   
     int i;
     int index;
     int size, newsize, oldsize;
-    int max_total_size = 0;
-    int total_size = 0;
+    size_t max_total_size = 0;  /* heaps of several GB (-s) overflow an int */
+    size_t total_size = 0;
     char *p;
     char *newp, *oldp;
 
-    /* initialize the heap and the mm malloc package */
+    /* initialize the heap and the mm malloc package; start with no
+       resident pages so that mem_resident() only sees this trace */
     mem_reset_brk();
-    if (mm_init() < 0)
+    mem_release(mem_heap_lo(), mem_max_heap);
+    if (init_mm() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	if (frag_csv != NULL && i % frag_interval == 0)
+	    frag_sample(i, total_size);
+
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm_alloc_op(&trace->ops[i])) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1286,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm_realloc_op(oldp, oldsize, newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1307,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (arena == NULL)
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,13 +1316,86 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+	case EPOCH: /* arena_reset; mm gets the FREE ops that follow */
+	    if (arena != NULL)
+		arena_reset(arena);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
+    if (frag_csv != NULL)
+	frag_sample(i, total_size);
+
+    stats->peak = mem_peak_heapsize();
+    stats->resident = mem_resident();
+    return ((double)max_total_size / (double)stats->peak);
+}
+
+
+/*
+ * open_frag_csv - Create <trace>.frag.csv in the current directory for
+ *     the fragmentation samples of one trace and write its header row
+ */
+static FILE *open_frag_csv(char *tracefile)
+{
+    char path[MAXLINE];
+    char *base, *dot;
+    FILE *fp;
+    int bin;
+
+    base = strrchr(tracefile, '/');
+    strcpy(path, base ? base + 1 : tracefile);
+    if ((dot = strrchr(path, '.')) != NULL)
+	*dot = '\0';
+    strcat(path, ".frag.csv");
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not create %s", path);
+	unix_error(msg);
+    }
+    if (verbose)
+	printf("Writing fragmentation samples to %s\n", path);
+
+    fprintf(fp, "op,heap,mapped,payload,usable,padding,overhead,"
+	    "alloc_blocks,slab_objs,slab_free,free_blocks,free_bytes,"
+	    "largest_free,ext_frag,util");
+    for (bin = 0; bin < MM_HIST_BINS; bin++)
+	fprintf(fp, ",free_%d", 16 << bin);
+    fprintf(fp, "\n");
+    return fp;
+}
 
-    return ((double)max_total_size / (double)mem_heapsize());
+/*
+ * frag_sample - Append one row describing the heap after opnum ops, with
+ *     payload bytes live. padding is the room allocated blocks have past
+ *     their payloads; ext_frag is 1 - largest_free/free_bytes.
+ */
+static void frag_sample(int opnum, size_t payload)
+{
+    mm_heapstats_t st;
+    size_t total;
+    int bin;
+
+    mm_heapstats(&st);
+    total = st.heap + st.mapped;
+    fprintf(frag_csv, "%d,%lu,%lu,%lu,%lu,%ld,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.4f",
+	    opnum, (unsigned long)st.heap, (unsigned long)st.mapped,
+	    (unsigned long)payload, (unsigned long)st.usable,
+	    (long)st.usable - (long)payload,
+	    (unsigned long)st.overhead, (unsigned long)st.alloc_blocks,
+	    (unsigned long)st.slab_objs, (unsigned long)st.slab_free,
+	    (unsigned long)st.free_blocks, (unsigned long)st.free_bytes,
+	    (unsigned long)st.largest_free,
+	    st.free_bytes ? 1.0 - (double)st.largest_free / st.free_bytes : 0.0,
+	    total ? (double)payload / total : 0.0);
+    for (bin = 0; bin < MM_HIST_BINS; bin++)
+	fprintf(frag_csv, ",%lu", (unsigned long)st.hist[bin]);
+    fprintf(frag_csv, "\n");
+
+    /* Every byte is accounted for exactly once */
+    assert(st.usable + st.overhead + st.free_bytes + st.slab_free == total);
 }
 
 
@@ -784,7 +1405,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -798,9 +1419,10 @@ static void eval_mm_speed(void *ptr)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case CALLOC: /* mm_calloc */
+        case MEMALIGN: /* mm_memalign */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_alloc_op(&trace->ops[i])) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -820,11 +1442,562 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+	case EPOCH: /* only marks where an arena would reset */
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 }
 
+/*
+ * eval_arena_speed - The -A counterpart of eval_mm_speed: the blocks
+ *    come from one arena, FREE ops are skipped and an EPOCH resets the
+ *    arena. A realloc is a new block plus a copy.
+ */
+static void eval_arena_speed(void *ptr)
+{
+    int i, index, size;
+    char *p;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    arena_t *a;
+
+    /* Reset the heap and initialize the mm package and the arena */
+    mem_reset_brk();
+    if (mm_init() < 0 || (a = arena_create(0)) == NULL)
+	app_error("mm_init failed in eval_arena_speed");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++)
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* arena_alloc */
+        case CALLOC: /* arena_alloc and memset */
+        case MEMALIGN: /* arena_memalign */
+            index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = arena_memalign(a, OP_ALIGN(trace->ops[i]), size)) == NULL)
+		app_error("arena_alloc error in eval_arena_speed");
+	    if (trace->ops[i].type == CALLOC)
+		memset(p, 0, size);
+            trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+            break;
+
+	case REALLOC: /* arena_alloc and memcpy */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = arena_alloc(a, size)) == NULL)
+		app_error("arena_alloc error in eval_arena_speed");
+	    memcpy(p, trace->blocks[index],
+		   MIN(trace->block_sizes[index], (size_t)size));
+            trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* nothing until the next reset */
+            break;
+
+	case EPOCH: /* arena_reset */
+	    arena_reset(a);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_arena_speed");
+        }
+    arena_destroy(a);
+}
+
+/*
+ * check_arena_trace - Exit with an error unless the trace has an EPOCH
+ *     op. In -A mode nothing is freed before an EPOCH, so a trace
+ *     without one would just fill the heap and fail in arena_alloc.
+ */
+static void check_arena_trace(char *tracefile)
+{
+    trace_t *trace;
+    int i;
+
+    trace = read_trace(tracedir, tracefile);
+    for (i = 0; i < trace->num_ops && trace->ops[i].type != EPOCH; i++)
+	;
+    if (i == trace->num_ops) {
+	sprintf(msg, "-A needs traces with EPOCH (\"e\") ops, and %s has "
+		"none; try -A -f traces/arena-bal.rep", tracefile);
+	app_error(msg);
+    }
+    free_trace(trace);
+}
+
+/*
+ * init_mm - Initialize the mm package and, in -A mode, the arena that
+ *     mm_alloc_op and mm_realloc_op allocate from. Returns -1 on error.
+ */
+static int init_mm(void)
+{
+    arena = NULL;
+    if (mm_init() < 0)
+	return -1;
+    if (use_arena && (arena = arena_create(0)) == NULL)
+	return -1;
+    return 0;
+}
+
+/*
+ * mm_alloc_op - Carry out an ALLOC, CALLOC or MEMALIGN request with mm,
+ *     or with the arena in -A mode
+ */
+static char *mm_alloc_op(traceop_t *op)
+{
+    char *p;
+
+    if (arena != NULL) {
+	p = arena_memalign(arena, OP_ALIGN(*op), op->size);
+	if (p != NULL && op->type == CALLOC)
+	    memset(p, 0, op->size);
+	return p;
+    }
+    switch (op->type) {
+    case CALLOC:
+	return mm_calloc(1, op->size);
+    case MEMALIGN:
+	return mm_memalign(1 << op->align, op->size);
+    default:
+	return mm_malloc(op->size);
+    }
+}
+
+/*
+ * mm_realloc_op - Resize oldp, which holds oldsize bytes, with mm, or
+ *     copy it into a new block from the arena in -A mode
+ */
+static char *mm_realloc_op(char *oldp, size_t oldsize, size_t size)
+{
+    char *p;
+
+    if (arena == NULL)
+	return mm_realloc(oldp, size);
+    if ((p = arena_alloc(arena, size)) != NULL)
+	memcpy(p, oldp, MIN(oldsize, size));
+    return p;
+}
+
+/*
+ * replay_thread - Replays one private copy of a trace against the
+ *    shared mm package. Every payload gets this thread's tag in its
+ *    first and last bytes, and the first byte is checked again before
+ *    the block is freed or reallocated, which catches blocks handed
+ *    out to two threads at once.
+ */
+static void *replay_thread(void *vargp)
+{
+    replay_t *r = (replay_t *)vargp;
+    trace_t *trace = r->trace;
+    int i, index, size;
+    char *p;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+
+	case ALLOC: /* mm_malloc */
+	case CALLOC: /* mm_calloc */
+	case MEMALIGN: /* mm_memalign */
+	    if ((p = mm_alloc_op(&trace->ops[i])) == NULL) {
+		r->status = REPLAY_NOMEM;
+		return NULL;
+	    }
+	    p[0] = p[size-1] = r->tag;
+	    r->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if (r->blocks[index][0] != (char)r->tag) {
+		r->status = REPLAY_CLOBBERED;
+		return NULL;
+	    }
+	    if ((p = mm_realloc(r->blocks[index], size)) == NULL) {
+		r->status = REPLAY_NOMEM;
+		return NULL;
+	    }
+	    p[0] = p[size-1] = r->tag;
+	    r->blocks[index] = p;
+	    break;
+
+	case FREE: /* mm_free */
+	    if (r->blocks[index][0] != (char)r->tag) {
+		r->status = REPLAY_CLOBBERED;
+		return NULL;
+	    }
+	    mm_free(r->blocks[index]);
+	    break;
+
+	case EPOCH:
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+	}
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_scaling - Reset the heap and replay nthreads copies of the
+ *    trace concurrently. Returns the wall-clock seconds taken and sets
+ *    *status to the worst outcome of any thread.
+ */
+static double eval_mm_scaling(trace_t *trace, int nthreads, int *status)
+{
+    pthread_t *tids;
+    replay_t *r;
+    struct timeval start, end;
+    int i;
+
+    if ((tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL ||
+	(r = (replay_t *)calloc(nthreads, sizeof(replay_t))) == NULL)
+	unix_error("malloc failed in eval_mm_scaling");
+    for (i = 0; i < nthreads; i++) {
+	r[i].trace = trace;
+	r[i].tag = i + 1;
+	r[i].status = REPLAY_OK;
+	if ((r[i].blocks = (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    unix_error("malloc failed in eval_mm_scaling");
+    }
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_scaling");
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++)
+	if (pthread_create(&tids[i], NULL, replay_thread, &r[i]) != 0)
+	    unix_error("pthread_create failed in eval_mm_scaling");
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    gettimeofday(&end, NULL);
+
+    *status = REPLAY_OK;
+    for (i = 0; i < nthreads; i++) {
+	if (r[i].status > *status)
+	    *status = r[i].status;
+	free(r[i].blocks);
+    }
+    free(r);
+    free(tids);
+    return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) * 1e-6;
+}
+
+/*
+ * printscaling - Print one row per thread count (1, 2, 4, ..., maxthreads)
+ *    with the aggregate throughput and its speedup over one thread.
+ *    Each point is the average of 10 runs, as in ftimer_gettod. Running
+ *    out of the simulated heap just ends the rows for a trace.
+ */
+static void printscaling(int tracenum, trace_t *trace, int maxthreads)
+{
+    int n, k, status;
+    double secs, ops, base = 0;
+
+    for (n = 1; ; n = (n * 2 > maxthreads && n < maxthreads) ? maxthreads : n * 2) {
+	secs = 0;
+	status = REPLAY_OK;
+	for (k = 0; k < 10 && status == REPLAY_OK; k++)
+	    secs += eval_mm_scaling(trace, n, &status) / 10;
+	ops = (double)trace->num_ops * n;
+	if (status == REPLAY_CLOBBERED)
+	    malloc_error(tracenum, 0, "payload clobbered during threaded replay");
+	if (status != REPLAY_OK) {
+	    printf("%2d%11d%9.0f%10s%7s%8s  %s\n", tracenum, n, ops,
+		   "-", "-", "-",
+		   status == REPLAY_NOMEM ? "(heap exhausted)" : "(clobbered)");
+	    return;
+	}
+	if (n == 1)
+	    base = ops / secs;
+	printf("%2d%11d%9.0f%10.6f%7.0f%8.2f\n", tracenum, n, ops, secs,
+	       (ops / 1e3) / secs, (ops / secs) / base);
+	if (n >= maxthreads)
+	    break;
+    }
+}
+
+/*
+ * eval_mm_trace - Check, then measure the utilization and throughput
+ *     of the mm package on one trace file
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges)
+{
+    trace_t *trace;
+    speed_t speed_params;    /* input parameters to eval_mm_speed */
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	if (frag_interval)
+	    frag_csv = open_frag_csv(tracefile);
+	stats->util = eval_mm_util(trace, tracenum, ranges, stats);
+	if (frag_csv != NULL) {
+	    fclose(frag_csv);
+	    frag_csv = NULL;
+	}
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(use_arena ? eval_arena_speed : eval_mm_speed,
+			    &speed_params);
+	fsecs_counts(stats->hw);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_traces - Check, then measure the utilization and throughput
+ *     of the mm package on each of the n trace files, one after another
+ *     or in up to num_jobs worker processes at once (-j)
+ */
+static void eval_mm_traces(char **tracefiles, int n, stats_t *stats)
+{
+    int i;
+    range_t *ranges = NULL;  /* keeps track of block extents for one trace */
+
+    if (num_jobs > 1 && n > 1) {
+	eval_mm_parallel(tracefiles, n, stats);
+	return;
+    }
+    for (i=0; i < n; i++)
+	eval_mm_trace(tracefiles[i], i, &stats[i], &ranges);
+    clear_ranges(&ranges);
+}
+
+/*
+ * eval_mm_parallel - Evaluate each trace in a worker process of its
+ *     own, up to num_jobs at a time. A worker gets a private copy of the
+ *     simulated heap with fork, so workers can't disturb each other, and
+ *     sends its stats back on a pipe. With -C, the worker in slot j is
+ *     pinned to pin_cpus[j] so its timing runs on a known core.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, stats_t *stats)
+{
+    int i, j, fd[2], status;
+    int next = 0, running = 0;
+    pid_t pid;
+    worker_t *workers;
+    result_t result;
+    range_t *ranges = NULL;
+
+    if ((workers = (worker_t *)calloc(num_jobs, sizeof(worker_t))) == NULL)
+	unix_error("eval_mm_parallel calloc failed");
+
+    /* Otherwise every worker would print our buffered output again */
+    fflush(stdout);
+
+    while (next < n || running > 0) {
+	/* Start a worker on the next trace in each free slot */
+	for (j = 0; j < num_jobs && next < n; j++) {
+	    if (workers[j].pid != 0)
+		continue;
+	    if (pipe(fd) < 0)
+		unix_error("eval_mm_parallel pipe failed");
+	    if ((pid = fork()) < 0)
+		unix_error("eval_mm_parallel fork failed");
+	    if (pid == 0) {
+		close(fd[0]);
+		if (num_pin_cpus)
+		    pin_cpu(pin_cpus[j % num_pin_cpus]);
+		reinit_fsecs();  /* the inherited counters count the parent */
+		errors = 0;
+		memset(&result, 0, sizeof(result));
+		eval_mm_trace(tracefiles[next], next, &result.stats, &ranges);
+		result.errors = errors;
+		fflush(stdout);
+		if (write(fd[1], &result, sizeof(result)) != sizeof(result))
+		    _exit(1);
+		_exit(0);
+	    }
+	    close(fd[1]);
+	    workers[j].pid = pid;
+	    workers[j].tracenum = next++;
+	    workers[j].fd = fd[0];
+	    running++;
+	}
+
+	/* Collect the result of whichever worker finishes first */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("eval_mm_parallel wait failed");
+	for (j = 0; j < num_jobs && workers[j].pid != pid; j++)
+	    ;
+	if (j == num_jobs)
+	    continue;
+	i = workers[j].tracenum;
+	if (read(workers[j].fd, &result, sizeof(result)) == sizeof(result)) {
+	    stats[i] = result.stats;
+	    errors += result.errors;
+	}
+	else {
+	    /* It crashed (or exited) before it could report */
+	    stats[i].valid = 0;
+	    errors++;
+	    if (WIFSIGNALED(status))
+		printf("ERROR [trace %d]: worker killed by signal %d\n",
+		       i, WTERMSIG(status));
+	    else
+		printf("ERROR [trace %d]: worker exited without a result\n", i);
+	}
+	close(workers[j].fd);
+	workers[j].pid = 0;
+	running--;
+    }
+    free(workers);
+}
+
+/*
+ * parse_cpus - Set pin_cpus from a list like "2,3,6-9" (-C). Returns -1
+ *     if the list is malformed.
+ */
+static int parse_cpus(char *list)
+{
+    char *p = list, *end;
+    long lo, hi, cpu;
+
+    num_pin_cpus = 0;
+    while (*p) {
+	lo = hi = strtol(p, &end, 10);
+	if (end == p || lo < 0)
+	    return -1;
+	if (*end == '-') {
+	    p = end + 1;
+	    hi = strtol(p, &end, 10);
+	    if (end == p || hi < lo)
+		return -1;
+	}
+	for (cpu = lo; cpu <= hi; cpu++) {
+	    pin_cpus = realloc(pin_cpus, (num_pin_cpus + 1) * sizeof(int));
+	    if (pin_cpus == NULL)
+		unix_error("ERROR: realloc failed in parse_cpus");
+	    pin_cpus[num_pin_cpus++] = cpu;
+	}
+	if (*end == ',')
+	    end++;
+	else if (*end != '\0')
+	    return -1;
+	p = end;
+    }
+    return num_pin_cpus > 0 ? 0 : -1;
+}
+
+/*
+ * pin_cpu - Run the calling process on the given CPU only
+ */
+static void pin_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+	sprintf(msg, "Could not pin to CPU %d", cpu);
+	unix_error(msg);
+    }
+}
+
+/*
+ * parse_fit - Select the placement policy named by name ("first", "next",
+ *     "best", "good" or "good:<k>"). Returns -1 for an unknown name.
+ */
+static int parse_fit(char *name)
+{
+    int i;
+    size_t len = strcspn(name, ":");
+
+    for (i = 0; i < MM_NUM_FITS; i++) {
+	if (strlen(fit_names[i]) != len || strncmp(name, fit_names[i], len))
+	    continue;
+	if (name[len] == ':') {
+	    if (i != MM_GOOD_FIT || (mm_fit_k = atoi(name + len + 1)) < 1)
+		return -1;
+	}
+	mm_fit = i;
+	return 0;
+    }
+    return -1;
+}
+
+/*
+ * printfrontier - Run every trace under every placement policy and print
+ *    the utilization and throughput of each, marking the policies that
+ *    no other policy beats on both average util and total throughput.
+ */
+static void printfrontier(char **tracefiles, int n)
+{
+    stats_t *stats[MM_NUM_FITS];
+    double util[MM_NUM_FITS], kops[MM_NUM_FITS], secs, ops;
+    int p, q, i, dominated;
+
+    for (p = 0; p < MM_NUM_FITS; p++) {
+	if ((stats[p] = (stats_t *)calloc(n, sizeof(stats_t))) == NULL)
+	    unix_error("stats calloc in printfrontier failed");
+	mm_fit = p;
+	if (verbose > 1)
+	    printf("\nTesting mm malloc with %s fit\n", fit_names[p]);
+	eval_mm_traces(tracefiles, n, stats[p]);
+
+	util[p] = secs = ops = 0;
+	for (i = 0; i < n; i++) {
+	    util[p] += stats[p][i].util / n;
+	    secs += stats[p][i].secs;
+	    ops += stats[p][i].ops;
+	}
+	kops[p] = (ops / 1e3) / secs;
+    }
+
+    printf("\nPlacement policies (%s free list, good = best of first %d):\n",
+	   mm_freelist == MM_IMPLICIT ? "implicit" : "seglist", mm_fit_k);
+    printf("%-7s", "util%");
+    for (i = 0; i < n; i++)
+	printf("%6d", i);
+    printf("%8s\n", "avg");
+    for (p = 0; p < MM_NUM_FITS; p++) {
+	printf("%-7s", fit_names[p]);
+	for (i = 0; i < n; i++)
+	    printf("%6.0f", stats[p][i].valid ? stats[p][i].util * 100.0 : 0.0);
+	printf("%7.1f%%\n", util[p] * 100.0);
+    }
+    printf("%-7s", "Kops");
+    for (i = 0; i < n; i++)
+	printf("%6d", i);
+    printf("%8s\n", "total");
+    for (p = 0; p < MM_NUM_FITS; p++) {
+	printf("%-7s", fit_names[p]);
+	for (i = 0; i < n; i++)
+	    printf("%6.0f", stats[p][i].valid ?
+		   (stats[p][i].ops / 1e3) / stats[p][i].secs : 0.0);
+	printf("%8.0f\n", kops[p]);
+    }
+
+    printf("Frontier (util vs. Kops):");
+    for (p = 0; p < MM_NUM_FITS; p++) {
+	dominated = 0;
+	for (q = 0; q < MM_NUM_FITS; q++)
+	    if (util[q] >= util[p] && kops[q] >= kops[p] &&
+		(util[q] > util[p] || kops[q] > kops[p]))
+		dominated = 1;
+	if (!dominated)
+	    printf(" %s", fit_names[p]);
+    }
+    printf("\n");
+    for (p = 0; p < MM_NUM_FITS; p++)
+	free(stats[p]);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -840,7 +2013,9 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* posix_memalign */
+	    if ((p = libc_alloc_op(&trace->ops[i])) == NULL) {
 		malloc_error(tracenum, i, "libc malloc failed");
 		unix_error("System message");
 	    }
@@ -861,6 +2036,9 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+	case EPOCH:
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -877,16 +2055,17 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 static void eval_libc_speed(void *ptr)
 {
     int i;
-    int index, size, newsize;
+    int index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case CALLOC: /* calloc */
+        case MEMALIGN: /* posix_memalign */
 	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
+	    if ((p = libc_alloc_op(&trace->ops[i])) == NULL)
 		unix_error("malloc failed in eval_libc_speed");
 	    trace->blocks[index] = p;
 	    break;
@@ -910,6 +2089,26 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
+/*
+ * libc_alloc_op - Carry out an ALLOC, CALLOC or MEMALIGN request with libc
+ */
+static char *libc_alloc_op(traceop_t *op)
+{
+    void *p;
+
+    switch (op->type) {
+    case CALLOC:
+	return calloc(1, op->size);
+    case MEMALIGN:
+	if (posix_memalign(&p, (1 << op->align) < sizeof(void *) ?
+			   sizeof(void *) : 1 << op->align, op->size) != 0)
+	    return NULL;
+	return p;
+    default:
+	return malloc(op->size);
+    }
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -926,17 +2125,23 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%8s%8s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops",
+	   "peakKB", "residKB");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (stats[i].peak) /* libc has no simulated heap */
+		printf("%8lu%8lu\n", (unsigned long)stats[i].peak / 1024,
+		       (unsigned long)stats[i].resident / 1024);
+	    else
+		printf("%8s%8s\n", "-", "-");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -970,6 +2175,46 @@ static void printresults(int n, stats_t *stats)
 	       "-");
     }
 
+    printcounters(n, stats);
+}
+
+/*
+ * printcounters - Print the hardware event counts per op of each trace,
+ *     if the timing package could count any
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, j;
+    double *hw;
+
+    for (i = 0; i < n; i++)
+	if (stats[i].valid && stats[i].hw[FPERF_CYCLES] >= 0)
+	    break;
+    if (i == n)
+	return;
+
+    printf("%5s%9s%9s%6s%10s%10s\n",
+	   "trace", "cyc/op", "ins/op", "IPC", "cmiss/op", "bmiss/op");
+    for (i = 0; i < n; i++) {
+	hw = stats[i].hw;
+	if (!stats[i].valid || hw[FPERF_CYCLES] < 0) {
+	    printf("%2d%12s%9s%6s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%12.1f", i, hw[FPERF_CYCLES] / stats[i].ops);
+	if (hw[FPERF_INSTRS] >= 0)
+	    printf("%9.1f%6.2f", hw[FPERF_INSTRS] / stats[i].ops,
+		   hw[FPERF_INSTRS] / hw[FPERF_CYCLES]);
+	else
+	    printf("%9s%6s", "-", "-");
+	for (j = FPERF_CACHE_MISSES; j <= FPERF_BRANCH_MISSES; j++) {
+	    if (hw[j] >= 0)
+		printf("%10.2f", hw[j] / stats[i].ops);
+	    else
+		printf("%10s", "-");
+	}
+	printf("\n");
+    }
 }
 
 /* 
@@ -999,19 +2244,53 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * parse_size - Set *n from a byte count given on the command line.
+ *     Returns -1, leaving *n alone, if arg is not a decimal number >= 0.
+ */
+static int parse_size(char *arg, size_t *n)
+{
+    char *end;
+    unsigned long val;
+
+    if (*arg < '0' || *arg > '9')  /* strtoul would take "-1" */
+	return -1;
+    errno = 0;
+    val = strtoul(arg, &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+	return -1;
+    *n = val;
+    return 0;
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValSA] [-f <file>] [-t <dir>] [-m <mode>] [-P <fit>] [-T <n>] [-r <n>] [-M <n>] [-D <n>] [-H <n>] [-c <n>] [-s <MB>] [-j <n>] [-C <cpus>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A         Allocate from an arena that each EPOCH (\"e\") resets;\n"
+		    "\t           every trace must have EPOCH ops.\n");
+    fprintf(stderr, "\t-c <n>     Check the heap every n ops of the correctness pass (0: never).\n");
+    fprintf(stderr, "\t-C <cpus>  Pin the driver, or its workers, to CPUs like 2,3,6-9.\n");
+    fprintf(stderr, "\t-D <n>     Defer coalescing until n bytes of small frees wait (0: never).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <n>     Sample fragmentation every n ops into <trace>.frag.csv.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate n traces at once in worker processes (0: one per CPU).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-m <mode>  Free list: implicit or seglist (default).\n");
+    fprintf(stderr, "\t-P <fit>   Placement: first (default), next, best, good[:k], or all.\n");
+    fprintf(stderr, "\t-M <n>     Map requests of at least n bytes (0: never).\n");
+    fprintf(stderr, "\t-r <n>     Release pages of free blocks of at least n bytes.\n");
+    fprintf(stderr, "\t-s <MB>    Let the simulated heap grow to MB megabytes (default %d).\n",
+	    MAX_HEAP >> 20);
+    fprintf(stderr, "\t-S         Don't use slabs for small requests.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Only measure scaling on 1, 2, 4, ..., n threads.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +11,82 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* The most the heap can grow to; set it before mem_init */
+size_t mem_max_heap = MAX_HEAP;
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_len;       /* mem_max_heap when the heap was mapped */
+static size_t mem_peak;      /* largest footprint since the last reset */
+static char *mem_clean;      /* heap bytes at or above it still read as zeros */
+
+/* Regions handed out by mem_map, outside of the simulated heap */
+typedef struct {
+    char *addr;
+    size_t len;
+} map_t;
+static map_t *mem_maps;      /* live regions, in no particular order */
+static int mem_nmaps;        /* number of live regions */
+static int mem_maxmaps;      /* capacity of mem_maps */
+static size_t mem_mapped;    /* total bytes in live regions */
+static pthread_mutex_t mem_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * update_peak - fold the current footprint (heap plus mapped regions)
+ *    into the high water mark
+ */
+static void update_peak(void)
+{
+    size_t cur = (size_t)(__atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE) - mem_start_brk) +
+	__atomic_load_n(&mem_mapped, __ATOMIC_ACQUIRE);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (cur > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, cur, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * raise_to - atomically raise *p to at least val
+ */
+static void raise_to(char **p, char *val)
+{
+    char *cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (val > cur &&
+	   !__atomic_compare_exchange_n(p, &cur, val, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_init - initialize the memory system model. The heap starts on a
+ *    page boundary and, like fresh sbrk memory, reads as zeros.
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    /* map the storage we will use to model the available VM; pages
+       are only backed once touched, so a big limit costs nothing */
+    mem_len = mem_max_heap;
+    mem_start_brk = mmap(NULL, mem_len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_max_addr = mem_start_brk + mem_len;   /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_clean = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
@@ -39,33 +94,185 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, mem_len);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap every region still left from mem_map
  */
 void mem_reset_brk()
 {
+    int i;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (i = 0; i < mem_nmaps; i++)
+	munmap(mem_maps[i].addr, mem_maps[i].len);
+    mem_nmaps = 0;
+    mem_mapped = 0;
+    pthread_mutex_unlock(&mem_map_lock);
+
     mem_brk = mem_start_brk;
+    mem_peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, but never below its first byte.
+ *    incr is an intptr_t rather than an int so that heaps over 2 GB
+ *    (mdriver -s) can grow and shrink by more than INT_MAX at once.
+ *    Safe to call from several threads at once.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk = __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE);
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+    /* Atomically bump the brk so that concurrent callers get disjoint areas */
+    do {
+	if (((old_brk + incr) < mem_start_brk) ||
+	    ((old_brk + incr) > mem_max_addr)) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk + incr,
+					  0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    raise_to(&mem_clean, old_brk + incr);
+    update_peak();
+    return (void *)old_brk;
+}
+
+/*
+ * mem_map - map a fresh, zeroed region of len bytes outside of the
+ *    heap, like mmap(MAP_ANONYMOUS). Returns (void *)-1 on failure.
+ */
+void *mem_map(size_t len)
+{
+    char *addr;
+    map_t *maps;
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
 	return (void *)-1;
+
+    pthread_mutex_lock(&mem_map_lock);
+    if (mem_nmaps == mem_maxmaps) {
+	mem_maxmaps = mem_maxmaps ? 2 * mem_maxmaps : 16;
+	if ((maps = (map_t *)realloc(mem_maps, mem_maxmaps * sizeof(map_t))) == NULL) {
+	    fprintf(stderr, "mem_map: realloc error\n");
+	    exit(1);
+	}
+	mem_maps = maps;
     }
-    mem_brk += incr;
-    return (void *)old_brk;
+    mem_maps[mem_nmaps].addr = addr;
+    mem_maps[mem_nmaps].len = len;
+    mem_nmaps++;
+    mem_mapped += len;
+    pthread_mutex_unlock(&mem_map_lock);
+
+    update_peak();
+    return (void *)addr;
+}
+
+/* find_map - index of the region starting at addr; mem_map_lock held */
+static int find_map(void *addr)
+{
+    int i;
+
+    for (i = 0; i < mem_nmaps; i++)
+	if (mem_maps[i].addr == (char *)addr)
+	    return i;
+    fprintf(stderr, "ERROR: %p was not returned by mem_map\n", addr);
+    exit(1);
+}
+
+/*
+ * mem_remap - grow or shrink a region from mem_map to newlen bytes,
+ *    moving it if needed. Returns the new start or (void *)-1.
+ */
+void *mem_remap(void *addr, size_t newlen)
+{
+    char *newaddr;
+    int i;
+
+    pthread_mutex_lock(&mem_map_lock);
+    i = find_map(addr);
+    newaddr = mremap(addr, mem_maps[i].len, newlen, MREMAP_MAYMOVE);
+    if (newaddr == MAP_FAILED) {
+	pthread_mutex_unlock(&mem_map_lock);
+	return (void *)-1;
+    }
+    mem_mapped += newlen - mem_maps[i].len;
+    mem_maps[i].addr = newaddr;
+    mem_maps[i].len = newlen;
+    pthread_mutex_unlock(&mem_map_lock);
+
+    update_peak();
+    return (void *)newaddr;
+}
+
+/*
+ * mem_unmap - give a region from mem_map back to the OS
+ */
+void mem_unmap(void *addr)
+{
+    int i;
+
+    pthread_mutex_lock(&mem_map_lock);
+    i = find_map(addr);
+    munmap(addr, mem_maps[i].len);
+    mem_mapped -= mem_maps[i].len;
+    mem_maps[i] = mem_maps[--mem_nmaps];
+    pthread_mutex_unlock(&mem_map_lock);
+}
+
+/*
+ * mem_in_map - is [lo, hi] inside a single region from mem_map?
+ */
+int mem_in_map(void *lo, void *hi)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (i = 0; i < mem_nmaps && !found; i++)
+	found = (char *)lo >= mem_maps[i].addr &&
+	    (char *)hi < mem_maps[i].addr + mem_maps[i].len;
+    pthread_mutex_unlock(&mem_map_lock);
+    return found;
+}
+
+/*
+ * mem_release - madvise(MADV_DONTNEED) style hook: give the physical
+ *    pages wholly inside [addr, addr+len) back to the OS. The range stays
+ *    part of the heap and reads back as zeros once it is touched again.
+ */
+void mem_release(void *addr, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *lo = (char *)(((unsigned long)addr + pagesize - 1) & ~(pagesize - 1));
+    char *hi = (char *)(((unsigned long)addr + len) & ~(pagesize - 1));
+    char *brk = __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE);
+
+    if (lo < hi) {
+	madvise(lo, hi - lo, MADV_DONTNEED);
+
+	/* Everything past the brk is zero again if the range covered it */
+	if (lo <= brk && hi >= __atomic_load_n(&mem_clean, __ATOMIC_RELAXED))
+	    __atomic_store_n(&mem_clean, brk, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * mem_clean_lo - return the lowest heap address from which on every
+ *    byte still reads as zero: mem_sbrk has not handed it out since
+ *    mem_init, or mem_release has zeroed it since. Calloc can skip
+ *    clearing memory that lies above it.
+ */
+void *mem_clean_lo()
+{
+    return (void *)__atomic_load_n(&mem_clean, __ATOMIC_ACQUIRE);
 }
 
 /*
@@ -81,7 +288,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(__atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE) - 1);
 }
 
 /*
@@ -89,7 +296,56 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(__atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE) - mem_start_brk);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest footprint (heap size plus
+ *    mapped regions) since the last mem_reset_brk. It can exceed
+ *    mem_heapsize() once the heap shrinks or regions are mapped.
+ */
+size_t mem_peak_heapsize()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_ACQUIRE);
+}
+
+/* resident_bytes - bytes of the pages spanning [lo, hi) found by mincore */
+static size_t resident_bytes(char *lo, char *hi)
+{
+    size_t pagesize = mem_pagesize();
+    size_t i, npages, resident = 0;
+    unsigned char *vec;
+
+    lo = (char *)((unsigned long)lo & ~(pagesize - 1));
+    if ((npages = (hi - lo + pagesize - 1) / pagesize) == 0)
+	return 0;
+    if ((vec = (unsigned char *)malloc(npages)) == NULL) {
+	fprintf(stderr, "mem_resident: malloc error\n");
+	exit(1);
+    }
+    if (mincore(lo, hi - lo, vec) == 0)
+	for (i = 0; i < npages; i++)
+	    if (vec[i] & 1)
+		resident += pagesize;
+    free(vec);
+    return resident;
+}
+
+/*
+ * mem_resident() - returns the bytes of heap and mapped pages that are
+ *    currently backed by physical memory
+ */
+size_t mem_resident()
+{
+    size_t resident;
+    int i;
+
+    resident = resident_bytes(mem_start_brk, __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE));
+    pthread_mutex_lock(&mem_map_lock);
+    for (i = 0; i < mem_nmaps; i++)
+	resident += resident_bytes(mem_maps[i].addr, mem_maps[i].addr + mem_maps[i].len);
+    pthread_mutex_unlock(&mem_map_lock);
+    return resident;
 }
 
 /*
@@ -1,11 +1,22 @@
+#include <stdint.h>
 #include <unistd.h>
 
+extern size_t mem_max_heap;        /* heap limit, read by mem_init */
+
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+void mem_release(void *addr, size_t len);
+void *mem_clean_lo(void);
+size_t mem_resident(void);
+void *mem_map(size_t len);
+void *mem_remap(void *addr, size_t newlen);
+void mem_unmap(void *addr);
+int mem_in_map(void *lo, void *hi);
 size_t mem_pagesize(void);
 
@@ -1,9 +1,66 @@
 /*
- * implicit free list 的实现方式，csapp 书中已经给出了完整的代码
+ * 两种空闲块组织方式，运行时由 mm_freelist 选择（mdriver -m）:
+ *   MM_IMPLICIT - implicit free list，csapp 书中已经给出了完整的代码，
+ *                 find_fit 从 heap_listp 开始遍历整个堆
+ *   MM_SEGLIST  - segregated explicit free list，按大小分级的双向链表，
+ *                 前驱/后继指针存放在空闲块的 payload 中；不小于 TREE_MIN
+ *                 的大块放在一棵按 size 排序的 splay 树里做 best-fit，每个
+ *                 结点后面挂着同样大小的其它空闲块，指针同样放在 payload 中
+ *
+ * 链表指针存为相对 mem_heap_lo() 的 4 字节偏移，这样 -m32/-m64 下空闲块的
+ * 最小大小都是 2*DSIZE (header + pred + succ + footer)，偏移 0 表示 NULL。
+ *
+ * 已分配块只有 header 没有 footer，header 的 bit 1 记录前一个块是否已分配，
+ * 只有前一个块空闲时才通过它的 footer 找到它 (PREV_BLKP)。
+ *
+ * 放置策略由 mm_fit 在 fit_table 里选 (mdriver -P)，两种组织方式都支持:
+ *   MM_FIRST_FIT - 第一个放得下的块
+ *   MM_NEXT_FIT  - 从上次停下的地方接着找：implicit 是堆里的 rover，
+ *                  seglist 是每一级链表各自的 seg_rover
+ *   MM_BEST_FIT  - 放得下的最小块
+ *   MM_GOOD_FIT  - 前 mm_fit_k 个放得下的块里最小的
+ * seglist 的各级链表按大小递增，所以在第一个有候选的级别里挑就够了；
+ * 链表里都没有时总是去 splay 树里 best-fit。
+ *
+ * mm_concurrent 非 0 时 (mdriver -T) 可以被多个线程同时调用：每个线程有自己
+ * 的 tcache，按块大小缓存不超过 TCACHE_MAX 的已释放小块，slab 对象另外按
+ * 大小级别缓存，命中时不加锁；其它情况都在 heap_lock 保护下操作中心堆。
+ * tcache 里的块在堆里仍然是已分配的。
+ *
+ * mm_slab 非 0 时不超过 SLAB_MAX 的请求由 slab 分配：每个大小级别从堆里拿
+ * 一页大小、页对齐的已分配块作为 run，run 开头是链表指针、计数和 bitmap，
+ * 后面是没有 header 的等长对象。slab_map 记录哪些页是 run。
+ *
+ * 释放后堆末尾的空闲块超过 mm_trim_threshold 时用负的 mem_sbrk 把它缩小到
+ * mm_trim_threshold；
+ * mm_release_threshold 非 0 时，不小于它的空闲块的 payload 通过 mem_release
+ * 把物理页还给系统。
+ *
+ * 不小于 mm_mmap_threshold 的请求不进堆，用 mem_map 单独映射一段内存：开头
+ * 空一个字保证对齐，header 里是整段映射的长度并带 MAPPED 位，释放时直接
+ * mem_unmap，realloc 用 mem_remap。
+ *
+ * mm_defer_limit 非 0 时推迟合并：释放的不超过 QUICK_MAX 的块先按大小放进
+ * quick list，在堆里仍然标记为已分配 (header 带 QUICK 位)，同样大小的请求
+ * 直接拿走；find_fit 找不到块或者 quick list 里的字节数超过 mm_defer_limit
+ * 时，consolidate 一次性把它们全部真正释放并合并。
+ *
+ * mm_calloc 从 mem_clean_lo() 以上切出的块本来就是 0，只清掉 mm 自己写过的
+ * 空闲块链表指针和 footer，不用整块 memset。mm_memalign 从一个足够大的空闲块
+ * 里切出对齐的块，前后多余的部分还是空闲块；slab 的 run 也是这样切出来的。
+ *
+ * mm_heapstats 遍历整个堆统计各类字节数，给 mdriver -H 的碎片分析用，
+ * 不在计时路径上。
+ *
+ * mm_checkheap 检查堆的一致性：块的大小和对齐、header/footer、prev_alloc 位、
+ * 没有相邻的空闲块、空闲块都在链表或树里并且链接正确、quick list 和 slab
+ * run 的计数。mdriver -c n 每 n 个操作调用一次。
  */
 #include "mm.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,57 +97,432 @@ team_t team = {
 #define CHUNKSIZE (1 << 12) /* extend heap 的默认大小 */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define PACK(size, alloc) ((size) | (alloc))
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
+#define MAPPED 0x4 /* header 的 bit 2: 块是单独映射的 */
+#define QUICK MAPPED /* 堆里的已分配块用同一位表示它在 quick list 里 */
+#define GET_PREV_ALLOC(p) (GET(p) & 0x2)
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | 0x2)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~0x2)
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)))
-#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+#define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) /* 仅当前一个块空闲 */
+
+/* 空闲块 payload 中的前驱/后继偏移 */
+#define PRED_OFF(bp) ((char *)(bp))
+#define SUCC_OFF(bp) ((char *)(bp) + WSIZE)
+#define PRED(bp) (off2ptr(GET(PRED_OFF(bp))))
+#define SUCC(bp) (off2ptr(GET(SUCC_OFF(bp))))
+
+/*
+ * splay 树的空闲块 payload: 左右孩子偏移和 pred/succ 共用位置，后面两个字是
+ * 同样大小的块组成的双向链表，树结点自己是表头，它的 SAME_PREV 为 NULL
+ */
+#define LEFT(bp) PRED(bp)
+#define RIGHT(bp) SUCC(bp)
+#define SAME_NEXT(bp) (off2ptr(GET((char *)(bp) + 2 * WSIZE)))
+#define SAME_PREV(bp) (off2ptr(GET((char *)(bp) + 3 * WSIZE)))
+#define SET_LEFT(bp, p) PUT(PRED_OFF(bp), ptr2off(p))
+#define SET_RIGHT(bp, p) PUT(SUCC_OFF(bp), ptr2off(p))
+#define SET_SAME_NEXT(bp, p) PUT((char *)(bp) + 2 * WSIZE, ptr2off(p))
+#define SET_SAME_PREV(bp, p) PUT((char *)(bp) + 3 * WSIZE, ptr2off(p))
+
+#define NUM_CLASSES 6                     /* 链表分级: [16,32) [32,64) ... [512,1024) */
+#define TREE_MIN (1 << (NUM_CLASSES + 4)) /* 不小于它的空闲块放进 splay 树 */
+
+#define TCACHE_MAX 256                               /* tcache 只缓存不超过它的块 */
+#define TCACHE_BINS ((TCACHE_MAX - 2 * DSIZE) / DSIZE + 1) /* 每 8 字节一级 */
+#define TCACHE_COUNT 16                              /* 每一级最多缓存的块数 */
+#define TCACHE_SLAB TCACHE_BINS /* slab 对象的缓存排在后面，每个 slab 级别一个 */
+
+#define QUICK_MAX TREE_MIN                     /* quick list 只放不超过它的块 */
+#define QUICK_BINS ((QUICK_MAX - 2 * DSIZE) / DSIZE + 1) /* 每 8 字节一级 */
+#define QUICK_FLUSH (64 * 1024) /* 合并出这么大的空闲块时顺便清空 quick list */
+
+#define SLAB_PAGE 4096                        /* run 的 payload 大小和对齐 */
+#define SLAB_MAX 64                           /* slab 只分配不超过它的请求 */
+#define SLAB_CLASSES (SLAB_MAX / DSIZE)       /* 对象大小 8, 16, ..., 64 */
+#define SLAB_HDR (4 * WSIZE + SLAB_PAGE / DSIZE / 8) /* 4 个字 + 512 位 bitmap */
+#define SLAB_BLOCK (SLAB_PAGE + DSIZE)        /* run 所在块的大小 */
+#define SLAB_MAP_PAGES (1 << 20)              /* slab_map 覆盖 32 位偏移能到的 4 GB */
+
+/* run 头部的字段 */
+#define RUN_NEXT(r) ((char *)(r))             /* 同一级别未满 run 的双向链表 */
+#define RUN_PREV(r) ((char *)(r) + WSIZE)
+#define RUN_CLASS(r) ((char *)(r) + 2 * WSIZE)
+#define RUN_USED(r) ((char *)(r) + 3 * WSIZE) /* 已分配的对象数 */
+#define RUN_BITMAP(r) ((unsigned int *)((char *)(r) + 4 * WSIZE)) /* 1 表示已分配 */
+#define RUN_OBJSIZE(cls) (((cls) + 1) * DSIZE)
+#define RUN_NOBJS(cls) ((unsigned int)(SLAB_PAGE - SLAB_HDR) / RUN_OBJSIZE(cls))
+
+int mm_freelist = MM_SEGLIST;
+int mm_fit = MM_FIRST_FIT;
+int mm_fit_k = 8;
+int mm_concurrent = 0;
+int mm_slab = 1;
+size_t mm_trim_threshold = 128 * 1024;
+size_t mm_release_threshold = 0;
+size_t mm_mmap_threshold = 128 * 1024;
+size_t mm_defer_limit = 0;
 
 void *extend_heap(size_t words);   /* 利用 mem_sbrk 扩展 heap 大小 */
 void *coalesce(void *bp);          /* 合并空闲块 */
 void place(void *bp, size_t size); /* 分配块 */
-void *find_fit(size_t size);       /* 寻找匹配的块，用首次适配法 */
+static void split_tail(void *bp, size_t asize); /* 已分配块多余的尾部还给堆 */
+void *find_fit(size_t size);       /* 按 mm_fit 选择的策略寻找匹配的块 */
+static void *first_fit(size_t asize);
+static void *next_fit(size_t asize);
+static void *best_fit(size_t asize);
+static void *good_fit(size_t asize);
+static void insert_free(void *bp); /* 把空闲块插入对应大小的链表 */
+static void remove_free(void *bp); /* 把空闲块从链表中摘下 */
+static char *splay(char *t, size_t size); /* 自顶向下伸展 */
+static void tree_insert(char *bp);
+static void tree_remove(char *bp);
+static char *tree_best_fit(size_t asize);
+static void *do_malloc(size_t size); /* 下面三个是不加锁的版本 */
+static void do_free(void *bp);
+static void *do_realloc(void *ptr, size_t size);
+static void *do_calloc(size_t size);
+static char *carve_aligned(size_t asize, size_t align); /* 切出 payload 对齐的已分配块 */
+static void tcache_key_init(void);
+static void *slab_alloc(size_t size); /* 分配 slab 对象，失败返回 NULL */
+static void slab_free(void *p);
+static void trim_heap(void *bp); /* 缩小堆末尾的空闲块 */
+static size_t free_block(void *bp); /* 真正释放一个堆里的块并合并 */
+static void consolidate(void);   /* 清空 quick list */
+static int check_fail(void *bp, const char *what); /* mm_checkheap 报告一处问题 */
+static size_t check_tree(char *t, size_t lo, size_t hi, size_t budget, int *errs);
 
 void *heap_listp = NULL;
+static unsigned int seg_heads[NUM_CLASSES]; /* 每一级链表的表头偏移 */
+static char *tree_root = NULL;              /* 大空闲块 splay 树的根 */
+
+static char *heap_base = NULL;              /* mem_heap_lo()，偏移的基址 */
+
+static unsigned int slab_partial[SLAB_CLASSES]; /* 每一级未满 run 的链表表头 */
+static unsigned char slab_map[SLAB_MAP_PAGES];  /* 非 0 表示这一页是 run */
+static unsigned int slab_map_hi = 0;            /* 用到的最大页号 + 1 */
+
+static size_t map_count = 0, map_bytes = 0; /* 单独映射的块数和总长度 */
+
+static unsigned int quick_heads[QUICK_BINS]; /* 每一级 quick list 的表头偏移 */
+static size_t quick_bytes = 0;               /* quick list 里块的总大小 */
+
+/* 放置策略表，下标是 mm_fit */
+static void *(*const fit_table[MM_NUM_FITS])(size_t) = {first_fit, next_fit, best_fit, good_fit};
+static char *rover = NULL;                  /* implicit next-fit 上次停下的块 */
+static unsigned int seg_rover[NUM_CLASSES]; /* seglist next-fit 每一级的起点偏移 */
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER; /* 保护中心堆 */
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* 只用来在线程退出时清空 tcache */
+static unsigned int heap_gen = 0; /* 每次 mm_init 加一，旧的 tcache 随之作废 */
+
+/* 每个线程的小块缓存，块之间用 payload 的第一个字单向链接 */
+static __thread struct {
+    unsigned int gen;
+    unsigned int heads[TCACHE_BINS + SLAB_CLASSES];
+    unsigned char counts[TCACHE_BINS + SLAB_CLASSES];
+} tcache;
+
+static inline char *off2ptr(unsigned int off) {
+    return off ? heap_base + off : NULL;
+}
+
+static inline unsigned int ptr2off(void *p) {
+    return p ? (unsigned int)((char *)p - heap_base) : 0;
+}
+
+/* fix_rover - 块合并进 bp 之后，原来指向被合并块的 rover 改为指向 bp */
+static inline void fix_rover(char *bp) {
+    if (rover > bp && rover < NEXT_BLKP(bp)) rover = bp;
+}
+
+/* adjust_size - 请求的 size 只需要加上 header，但是块释放后要放得下 pred/succ 和 footer */
+static inline size_t adjust_size(size_t size) {
+    return MAX(2 * DSIZE, DSIZE * ((size + WSIZE + DSIZE - 1) / DSIZE));
+}
+
+/* size_class - 块大小所在的链表下标，每一级是 [2^(i+4), 2^(i+5)) */
+static inline int size_class(size_t size) {
+    int i = 0;
+    size >>= 5;
+    while (size && i < NUM_CLASSES - 1) {
+        size >>= 1;
+        i++;
+    }
+    return i;
+}
 
 /*
  * mm_init - initialize the malloc package.
  */
 int mm_init(void) {
+    if (mm_concurrent) pthread_once(&tcache_once, tcache_key_init);
+    heap_gen++;
+    memset(seg_heads, 0, sizeof(seg_heads));
+    memset(seg_rover, 0, sizeof(seg_rover));
+    memset(quick_heads, 0, sizeof(quick_heads));
+    quick_bytes = 0;
+    memset(slab_partial, 0, sizeof(slab_partial));
+    memset(slab_map, 0, slab_map_hi);
+    slab_map_hi = 0;
+    map_count = map_bytes = 0;  // mem_reset_brk 已经解除了所有映射
+    tree_root = NULL;
+    heap_base = mem_heap_lo();
     // 4*WSIZE: 序言块 + 结尾块，并满足对齐要求
     if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1) return -1;
     PUT(heap_listp, 0);                           // 对齐要求
     PUT(heap_listp + WSIZE, PACK(DSIZE, 1));      // 序言块 header
     PUT(heap_listp + 2 * WSIZE, PACK(DSIZE, 1));  // 序言块 footer
-    PUT(heap_listp + 3 * WSIZE, PACK(0, 1));      // 结尾块
+    PUT(heap_listp + 3 * WSIZE, PACK(0, 0x2 | 1));  // 结尾块，序言块已分配
     heap_listp += 2 * WSIZE;
+    rover = heap_listp;
 
     if (extend_heap(CHUNKSIZE / WSIZE) == NULL) return -1;
     return 0;
 }
 
+/* is_slab - p 是否是 slab 对象，p 可以在堆外 (单独映射的块) */
+static inline int is_slab(void *p) {
+    size_t off = (char *)p - heap_base;
+    return (char *)p >= heap_base && off < (size_t)SLAB_MAP_PAGES * SLAB_PAGE &&
+           slab_map[off / SLAB_PAGE];
+}
+
+/* is_mapped - 非 slab 对象 bp 是否是单独映射的块 */
+static inline int is_mapped(void *bp) {
+    return GET(HDRP(bp)) & MAPPED;
+}
+
+/* map_len - 放下 size 字节 payload 的映射长度 */
+static inline size_t map_len(size_t size) {
+    return (size + DSIZE + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/*
+ * map_block - 单独映射一段内存作为已分配块，失败返回 NULL
+ */
+static void *map_block(size_t size) {
+    size_t len = map_len(size);
+    char *region;
+
+    if ((region = mem_map(len)) == (void *)-1) return NULL;
+    map_count++;
+    map_bytes += len;
+    PUT(region + WSIZE, PACK(len, MAPPED | 1));
+    return region + DSIZE;
+}
+
+/*
+ * remap_block - 把单独映射的块伸缩到正好放下 size 字节的页数，页数不变就
+ *     不动；缩小时把多出来的页还给系统，免得它们一直算在映射的内存里
+ */
+static void *remap_block(void *bp, size_t size) {
+    size_t len = map_len(size);
+    char *region;
+
+    if (len == GET_SIZE(HDRP(bp))) return bp;
+    if ((region = mem_remap((char *)bp - DSIZE, len)) == (void *)-1) return NULL;
+    map_bytes += len - GET_SIZE(region + WSIZE);
+    PUT(region + WSIZE, PACK(len, MAPPED | 1));
+    return region + DSIZE;
+}
+
+/*
+ * tcache_get - 从当前线程的 tcache 中取一个能满足 size 字节请求的块：
+ *     do_malloc 会用 slab 的请求取同一级别的 slab 对象，其它的取大小正好
+ *     为 adjust_size(size) 的块
+ */
+static void *tcache_get(size_t size) {
+    size_t asize = adjust_size(size);
+    int i = (asize - 2 * DSIZE) / DSIZE;
+    char *bp;
+
+    if (mm_slab && size <= SLAB_MAX)
+        i = TCACHE_SLAB + (size - 1) / DSIZE;
+    else if (asize > TCACHE_MAX)
+        return NULL;
+    if (tcache.gen != heap_gen) return NULL;
+    if ((bp = off2ptr(tcache.heads[i])) == NULL) return NULL;
+    tcache.heads[i] = GET(bp);
+    tcache.counts[i]--;
+    return bp;
+}
+
+/*
+ * tcache_put - 把块放进当前线程的 tcache，满了或者块太大返回 0
+ */
+static int tcache_put(void *bp) {
+    size_t size;
+    int i;
+
+    if (is_slab(bp)) {  // 对象还没释放，run 不会被拆掉，级别也不会变
+        i = TCACHE_SLAB + GET(RUN_CLASS(heap_base + ptr2off(bp) / SLAB_PAGE * SLAB_PAGE));
+    } else {
+        // 不加锁读 header：块已分配时大小不会变，别的线程只会改它的 prev_alloc 位
+        size = __atomic_load_n((unsigned int *)HDRP(bp), __ATOMIC_RELAXED) & ~0x7;
+        if (size > TCACHE_MAX) return 0;
+        i = (size - 2 * DSIZE) / DSIZE;
+    }
+    if (tcache.gen != heap_gen) {  // 堆重新初始化过，原来缓存的块都失效了
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.gen = heap_gen;
+        pthread_setspecific(tcache_key, &tcache);
+    }
+    if (tcache.counts[i] >= TCACHE_COUNT) return 0;
+    PUT(bp, tcache.heads[i]);
+    tcache.heads[i] = ptr2off(bp);
+    tcache.counts[i]++;
+    return 1;
+}
+
+/*
+ * tcache_flush - 线程退出时把它缓存的块还给中心堆
+ */
+static void tcache_flush(void *arg) {
+    char *bp;
+    int i;
+
+    (void)arg;  // 就是 &tcache，直接用线程局部变量
+    if (tcache.gen != heap_gen) return;
+    pthread_mutex_lock(&heap_lock);
+    for (i = 0; i < TCACHE_BINS + SLAB_CLASSES; i++)
+        while ((bp = off2ptr(tcache.heads[i])) != NULL) {
+            tcache.heads[i] = GET(bp);
+            do_free(bp);
+        }
+    pthread_mutex_unlock(&heap_lock);
+    memset(&tcache, 0, sizeof(tcache));
+}
+
+static void tcache_key_init(void) {
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+
 /*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+ * mm_malloc - 并发模式下先查 tcache，不命中再加锁从中心堆分配
  */
 void *mm_malloc(size_t size) {
+    void *bp;
+
+    if (!mm_concurrent) return do_malloc(size);
+    if (size != 0 && (bp = tcache_get(size)) != NULL) return bp;
+    pthread_mutex_lock(&heap_lock);
+    bp = do_malloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+/*
+ * mm_free - 并发模式下先放进 tcache，放不下再加锁还给中心堆
+ */
+void mm_free(void *bp) {
+    if (!mm_concurrent) {
+        do_free(bp);
+        return;
+    }
+    if (tcache_put(bp)) return;
+    pthread_mutex_lock(&heap_lock);
+    do_free(bp);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *mm_realloc(void *ptr, size_t size) {
+    void *newptr;
+
+    if (!mm_concurrent) return do_realloc(ptr, size);
+    pthread_mutex_lock(&heap_lock);
+    newptr = do_realloc(ptr, size);
+    pthread_mutex_unlock(&heap_lock);
+    return newptr;
+}
+
+/*
+ * mm_calloc - 分配 nmemb * size 字节并清零，乘法溢出时返回 NULL
+ */
+void *mm_calloc(size_t nmemb, size_t size) {
+    void *bp;
+
+    if (nmemb != 0 && size > (size_t)-1 / nmemb) return NULL;
+    size *= nmemb;
+    if (!mm_concurrent) return do_calloc(size);
+    if (size != 0 && (bp = tcache_get(size)) != NULL) return memset(bp, 0, size);
+    pthread_mutex_lock(&heap_lock);
+    bp = do_calloc(size);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+/*
+ * mm_memalign - payload 按 alignment (2 的幂) 对齐的块，不超过 ALIGNMENT 时
+ *     就是 mm_malloc
+ */
+void *mm_memalign(size_t alignment, size_t size) {
+    void *bp;
+
+    if (alignment & (alignment - 1)) return NULL;
+    if (alignment <= ALIGNMENT) return mm_malloc(size);
+    if (size == 0) return NULL;
+    if (!mm_concurrent) return carve_aligned(adjust_size(size), alignment);
+    pthread_mutex_lock(&heap_lock);
+    bp = carve_aligned(adjust_size(size), alignment);
+    pthread_mutex_unlock(&heap_lock);
+    return bp;
+}
+
+/*
+ * do_calloc - mem_clean_lo() 以上的内存还没有用过，都是 0。块里在它以上的
+ *     部分只有空闲时的链表/树指针 (前 4 个字) 和 footer 可能被写过，比如
+ *     extend_heap 和堆末尾的空闲块合并出来的块只需要清掉旧的那一段
+ */
+static void *do_calloc(size_t size) {
+    char *clean = mem_clean_lo(), *bp;  // 必须在分配之前取，分配可能扩展堆
+    ptrdiff_t dirty;
+    size_t bsize;
+
+    if ((bp = do_malloc(size)) == NULL) return NULL;
+    if (is_slab(bp)) return memset(bp, 0, size);
+    if (is_mapped(bp)) return bp;  // mem_map 的内存总是新的
+    if ((dirty = clean - bp) >= (ptrdiff_t)size) return memset(bp, 0, size);
+    bsize = GET_SIZE(HDRP(bp));
+    memset(bp, 0, MIN((size_t)MAX(dirty, 4 * WSIZE), bsize - WSIZE));
+    PUT(FTRP(bp), 0);
+    return bp;
+}
+
+/*
+ * do_malloc - 分配大小为 8 的倍数的块，没有合适的空闲块就扩展堆
+ */
+static void *do_malloc(size_t size) {
     size_t asize;  // adjusted size
     size_t extendsize;
     char *bp;
 
     if (size == 0) return NULL;
+    if (mm_slab && size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL) return bp;
+    if (mm_mmap_threshold && size >= mm_mmap_threshold && (bp = map_block(size)) != NULL)
+        return bp;
 
-    // 请求的 size 需要加上 DSIZE(header和footer) 而且要满足对齐要求
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
-    else
-        asize = DSIZE * ((size + DSIZE + DSIZE - 1) / DSIZE);
+    asize = adjust_size(size);
 
-    if ((bp = find_fit(asize)) != NULL) {
+    // 同样大小的块刚释放过，直接拿走，不用拆分
+    if (asize <= QUICK_MAX && quick_heads[(asize - 2 * DSIZE) / DSIZE] != 0) {
+        bp = off2ptr(quick_heads[(asize - 2 * DSIZE) / DSIZE]);
+        quick_heads[(asize - 2 * DSIZE) / DSIZE] = GET(bp);
+        quick_bytes -= asize;
+        PUT(HDRP(bp), GET(HDRP(bp)) & ~QUICK);
+        return bp;
+    }
+
+    if ((bp = find_fit(asize)) != NULL ||
+        (quick_bytes != 0 && (consolidate(), bp = find_fit(asize)) != NULL)) {
         place(bp, asize);
         return bp;
     }
@@ -103,29 +535,130 @@ void *mm_malloc(size_t size) {
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * do_free - 释放块并和相邻的空闲块合并
  */
-void mm_free(void *bp) {
+static void do_free(void *bp) {
+    size_t size;
+    char *next;
+
+    if (is_slab(bp)) {
+        slab_free(bp);
+        return;
+    }
+    if (is_mapped(bp)) {
+        map_count--;
+        map_bytes -= GET_SIZE(HDRP(bp));
+        mem_unmap((char *)bp - DSIZE);
+        return;
+    }
+    size = GET_SIZE(HDRP(bp));
+    next = NEXT_BLKP(bp);
+    if (!GET_ALLOC(HDRP(next))) next = NEXT_BLKP(next);
+    // 先不合并，放进 quick list；紧挨着堆顶的块除外，它要合并进去让堆能收缩
+    if (mm_defer_limit && size <= QUICK_MAX && GET_SIZE(HDRP(next)) != 0) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | QUICK);
+        PUT(bp, quick_heads[(size - 2 * DSIZE) / DSIZE]);
+        quick_heads[(size - 2 * DSIZE) / DSIZE] = ptr2off(bp);
+        quick_bytes += size;
+        if (quick_bytes > mm_defer_limit) consolidate();
+        return;
+    }
+    // 大块释放说明堆可能在收缩，quick 块不能一直挡着 trim_heap
+    if (free_block(bp) >= QUICK_FLUSH && quick_bytes != 0) consolidate();
+}
+
+/*
+ * free_block - 把已分配块 bp 标记为空闲，合并后放进空闲链表或树，
+ *     返回合并后的大小
+ */
+static size_t free_block(void *bp) {
     size_t size = GET_SIZE(HDRP(bp));
-    PUT(HDRP(bp), PACK(size, 0));
+
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
     PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    bp = coalesce(bp);
+    trim_heap(bp);
+    insert_free(bp);
+
+    // 保留 header、树/链表指针和 footer，中间整页的物理内存还给系统
+    size = GET_SIZE(HDRP(bp));
+    if (mm_release_threshold && size >= mm_release_threshold)
+        mem_release((char *)bp + 4 * WSIZE, size - 6 * WSIZE);
+    return size;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * consolidate - 把 quick list 里的块全部真正释放。相邻的两个 quick 块里
+ *     先释放的那个看到的邻居还是已分配的，轮到邻居释放时再合并到一起。
  */
-void *mm_realloc(void *ptr, size_t size) {
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
-
-    newptr = mm_malloc(size);
-    if (newptr == NULL) return NULL;
-    copySize = GET_SIZE(HDRP(oldptr));
-    if (size < copySize) copySize = size;
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
+static void consolidate(void) {
+    char *bp;
+    int i;
+
+    for (i = 0; i < QUICK_BINS; i++)
+        while ((bp = off2ptr(quick_heads[i])) != NULL) {
+            quick_heads[i] = GET(bp);
+            free_block(bp);
+        }
+    quick_bytes = 0;
+}
+
+/*
+ * do_realloc - 尽量原地完成:
+ *     缩小时把多余的尾部分割出去；
+ *     变大时先吸收后面的空闲块，块在堆末尾时只 mem_sbrk 不足的部分；
+ *     都不行才 mm_malloc + memcpy + mm_free。
+ *     slab 对象放得下就不动，否则搬走；单独映射的块用 mem_remap。
+ */
+static void *do_realloc(void *ptr, size_t size) {
+    size_t asize, oldsize, nextsize;
+    char *next, *newptr;
+
+    if (ptr == NULL) return do_malloc(size);
+    if (size == 0) {
+        do_free(ptr);
+        return NULL;
+    }
+    if (is_slab(ptr)) {
+        oldsize = RUN_OBJSIZE(GET(RUN_CLASS(heap_base + ptr2off(ptr) / SLAB_PAGE * SLAB_PAGE)));
+        if (size <= oldsize) return ptr;
+        if ((newptr = do_malloc(size)) == NULL) return NULL;
+        memcpy(newptr, ptr, oldsize);
+        slab_free(ptr);
+        return newptr;
+    }
+    if (is_mapped(ptr)) return remap_block(ptr, size);
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+    if (asize <= oldsize) {  // 缩小
+        split_tail(ptr, asize);
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    nextsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+    if (oldsize + nextsize >= asize) {  // 后面的空闲块足够大
+        remove_free(next);
+        PUT(HDRP(ptr), PACK(oldsize + nextsize, GET_PREV_ALLOC(HDRP(ptr)) | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+        fix_rover(ptr);
+        split_tail(ptr, asize);
+        return ptr;
+    }
+    if (GET_SIZE(HDRP(nextsize ? NEXT_BLKP(next) : next)) == 0) {  // 到堆末尾了
+        if (mem_sbrk(asize - oldsize - nextsize) == (void *)-1) return NULL;
+        if (nextsize) remove_free(next);
+        PUT(HDRP(ptr), PACK(asize, GET_PREV_ALLOC(HDRP(ptr)) | 1));
+        PUT(HDRP(NEXT_BLKP(ptr)), PACK(0, 0x2 | 1));  // 新的结尾块
+        fix_rover(ptr);
+        return ptr;
+    }
+
+    if ((newptr = do_malloc(size)) == NULL) return NULL;
+    memcpy(newptr, ptr, oldsize - WSIZE);  // 旧块的整个 payload
+    do_free(ptr);
     return newptr;
 }
 
@@ -136,56 +669,661 @@ void *extend_heap(size_t words) {
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
     if ((bp = mem_sbrk(size)) == (char *)-1) return NULL;
 
-    PUT(HDRP(bp), PACK(size, 0));
+    // 新块的 header 覆盖原来的结尾块，继承它的 prev_alloc 位
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
     PUT(FTRP(bp), PACK(size, 0));
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  // 新的结尾块
-    return coalesce(bp);
+    bp = coalesce(bp);
+    insert_free(bp);
+    return bp;
 }
 
+/*
+ * coalesce - 和相邻的空闲块合并，返回合并后的块。相邻块会先从链表中摘下，
+ *     bp 本身不在链表中，合并结果也不会插入链表，由调用者决定。
+ */
 void *coalesce(void *bp) {
     int next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    int prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(bp)));
+    int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t size = GET_SIZE(HDRP(bp));
 
-    // 4 种不同的情况
+    if (!next_alloc) remove_free(NEXT_BLKP(bp));
+    if (!prev_alloc) remove_free(PREV_BLKP(bp));
+
+    // 4 种不同的情况，合并后块的 prev_alloc 位取最前面那个块的
     if (next_alloc && prev_alloc)
         return bp;
     else if (!next_alloc && prev_alloc) {
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
         PUT(FTRP(bp), PACK(size, 0));
     } else if (next_alloc && !prev_alloc) {
         bp = PREV_BLKP(bp);
         size += GET_SIZE(HDRP(bp));
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
         PUT(FTRP(bp), PACK(size, 0));
     } else if (!next_alloc && !prev_alloc) {
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(HDRP(NEXT_BLKP(bp)));
         bp = PREV_BLKP(bp);
-        PUT(HDRP(bp), PACK(size, 0));
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
         PUT(FTRP(bp), PACK(size, 0));
     }
+    fix_rover(bp);
     return bp;
 }
 
+/*
+ * place - 在空闲块 bp 上分配 asize 字节，剩余部分足够大时分割成新的空闲块
+ */
 void place(void *bp, size_t asize) {
     size_t csize = GET_SIZE(HDRP(bp));
+    unsigned int prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    remove_free(bp);
 
     if (csize - asize < 2 * DSIZE) {  // 剩下的空间不足以分割新的空闲块
-        PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+        PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
     } else {  // 需要分割新的空闲块
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
+        PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
         bp = NEXT_BLKP(bp);
-        PUT(HDRP(bp), PACK(csize - asize, 0));
+        PUT(HDRP(bp), PACK(csize - asize, 0x2));
         PUT(FTRP(bp), PACK(csize - asize, 0));
+        insert_free(bp);
+    }
+}
+
+/*
+ * trim_heap - 空闲块 bp 在堆末尾并且超过 mm_trim_threshold 时缩小到
+ *     mm_trim_threshold，多出的部分还给 memlib。留下的空闲块让末尾的块
+ *     (比如不断 realloc 变大的块) 还能原地增长。bp 还不在空闲链表中。
+ */
+static void trim_heap(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp)), keep = ALIGN(MAX(mm_trim_threshold, CHUNKSIZE));
+
+    if (mm_trim_threshold == 0 || size <= keep || GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+        return;
+    if (mem_sbrk(-(intptr_t)(size - keep)) == (void *)-1) return;
+    PUT(HDRP(bp), PACK(keep, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), PACK(keep, 0));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  // 新的结尾块
+}
+
+/*
+ * split_tail - 已分配块 bp 缩小到 asize，尾部足够大时变成空闲块并与后面合并
+ */
+static void split_tail(void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    if (csize - asize < 2 * DSIZE) return;
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(csize - asize, 0x2));
+    PUT(FTRP(bp), PACK(csize - asize, 0));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    insert_free(coalesce(bp));
+}
+
+/*
+ * carve_aligned - 从一个放得下 asize + align 的空闲块里切出 payload 按 align
+ *     对齐、大小为 asize 的已分配块，前后多余的部分还是空闲块
+ */
+static char *carve_aligned(size_t asize, size_t align) {
+    size_t need = asize + align + 2 * DSIZE, csize, lead;
+    unsigned int prev_alloc;
+    char *bp, *r;
+
+    if ((bp = find_fit(need)) == NULL &&
+        (quick_bytes == 0 || (consolidate(), bp = find_fit(need)) == NULL) &&
+        (bp = extend_heap(MAX(CHUNKSIZE, need) / WSIZE)) == NULL)
+        return NULL;
+    lead = (align - (size_t)bp % align) % align;
+    if (lead != 0 && lead < 2 * DSIZE) lead += align;  // 前面剩下的要能单独成块
+
+    csize = GET_SIZE(HDRP(bp));
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    remove_free(bp);
+    if (lead != 0) {
+        PUT(HDRP(bp), PACK(lead, prev_alloc));
+        PUT(FTRP(bp), PACK(lead, 0));
+        insert_free(bp);
+        prev_alloc = 0;
+    }
+    r = bp + lead;
+    PUT(HDRP(r), PACK(csize - lead, prev_alloc | 1));
+    SET_PREV_ALLOC(HDRP(NEXT_BLKP(r)));
+    split_tail(r, asize);
+    return r;
+}
+
+/*
+ * new_run - 从堆里切出一个 payload 页对齐的已分配块作为 cls 级的 run。
+ *     memlib 的堆从页边界开始，所以地址对齐也就是偏移对齐
+ */
+static char *new_run(int cls) {
+    unsigned int i;
+    char *r;
+
+    if ((r = carve_aligned(SLAB_BLOCK, SLAB_PAGE)) == NULL) return NULL;
+
+    // 初始化 run 头部，bitmap 中超出对象个数的位预先置 1
+    PUT(RUN_NEXT(r), 0);
+    PUT(RUN_PREV(r), 0);
+    PUT(RUN_CLASS(r), cls);
+    PUT(RUN_USED(r), 0);
+    memset(RUN_BITMAP(r), 0, SLAB_HDR - 4 * WSIZE);
+    for (i = RUN_NOBJS(cls); i < (SLAB_HDR - 4 * WSIZE) * 8; i++)
+        RUN_BITMAP(r)[i / 32] |= 1u << (i % 32);
+
+    slab_map[ptr2off(r) / SLAB_PAGE] = 1;
+    slab_map_hi = MAX(slab_map_hi, ptr2off(r) / SLAB_PAGE + 1);
+    return r;
+}
+
+/* run_push/run_unlink - 维护每一级未满 run 的链表 */
+static void run_push(char *r) {
+    int cls = GET(RUN_CLASS(r));
+    char *head = off2ptr(slab_partial[cls]);
+
+    PUT(RUN_PREV(r), 0);
+    PUT(RUN_NEXT(r), ptr2off(head));
+    if (head != NULL) PUT(RUN_PREV(head), ptr2off(r));
+    slab_partial[cls] = ptr2off(r);
+}
+
+static void run_unlink(char *r) {
+    char *prev = off2ptr(GET(RUN_PREV(r))), *next = off2ptr(GET(RUN_NEXT(r)));
+
+    if (prev != NULL)
+        PUT(RUN_NEXT(prev), ptr2off(next));
+    else
+        slab_partial[GET(RUN_CLASS(r))] = ptr2off(next);
+    if (next != NULL) PUT(RUN_PREV(next), ptr2off(prev));
+}
+
+static void *slab_alloc(size_t size) {
+    int cls = (size - 1) / DSIZE, w;
+    unsigned int *bitmap, idx;
+    char *r;
+
+    if ((r = off2ptr(slab_partial[cls])) == NULL) {
+        if ((r = new_run(cls)) == NULL) return NULL;
+        run_push(r);
+    }
+    bitmap = RUN_BITMAP(r);
+    for (w = 0; bitmap[w] == ~0u; w++)  // 未满的 run 一定有 0 位
+        ;
+    idx = w * 32 + __builtin_ctz(~bitmap[w]);
+    bitmap[w] |= 1u << (idx % 32);
+    PUT(RUN_USED(r), GET(RUN_USED(r)) + 1);
+    if (GET(RUN_USED(r)) == RUN_NOBJS(cls)) run_unlink(r);  // 满了
+    return r + SLAB_HDR + idx * RUN_OBJSIZE(cls);
+}
+
+/*
+ * slab_free - 释放 slab 对象；run 空了并且这一级还有别的未满 run 时，
+ *     把整个 run 还给堆
+ */
+static void slab_free(void *p) {
+    char *r = heap_base + ptr2off(p) / SLAB_PAGE * SLAB_PAGE;
+    int cls = GET(RUN_CLASS(r));
+    unsigned int idx = ((char *)p - r - SLAB_HDR) / RUN_OBJSIZE(cls);
+    unsigned int used = GET(RUN_USED(r));
+
+    RUN_BITMAP(r)[idx / 32] &= ~(1u << (idx % 32));
+    PUT(RUN_USED(r), used - 1);
+    if (used == RUN_NOBJS(cls)) run_push(r);  // 原来是满的
+    if (used == 1 && (GET(RUN_NEXT(r)) != 0 || GET(RUN_PREV(r)) != 0)) {
+        run_unlink(r);
+        slab_map[ptr2off(r) / SLAB_PAGE] = 0;
+        do_free(r);
     }
 }
 
+/*
+ * find_fit - 用 mm_fit 选择的策略寻找不小于 asize 的空闲块
+ */
 void *find_fit(size_t asize) {
-    void *bp;
-    for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
-        if (!GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) >= asize) return bp;
+    return fit_table[mm_fit](asize);
+}
+
+/*
+ * scan_heap - implicit: 在 [from, to) 里找前 k 个放得下的块，返回其中最小的；
+ *     to 为 NULL 表示一直到结尾块
+ */
+static char *scan_heap(char *from, char *to, size_t asize, int k) {
+    char *bp, *best = NULL;
+    size_t size, best_size = 0;
+
+    for (bp = from; bp != to && (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (GET_ALLOC(HDRP(bp)) || size < asize) continue;
+        if (best == NULL || size < best_size) {
+            best = bp;
+            best_size = size;
+        }
+        if (--k == 0 || size == asize) break;
+    }
+    return best;
+}
+
+/*
+ * scan_lists - seglist: 从 asize 所在级别开始，在第一个有候选的级别里取前 k 个
+ *     放得下的块中最小的，链表里都没有就去树里找
+ */
+static char *scan_lists(size_t asize, int k) {
+    char *bp, *best = NULL;
+    size_t size, best_size = 0;
+    int i;
+
+    if (asize < TREE_MIN)
+        for (i = size_class(asize); i < NUM_CLASSES && best == NULL; i++)
+            for (bp = off2ptr(seg_heads[i]); bp != NULL; bp = SUCC(bp)) {
+                if ((size = GET_SIZE(HDRP(bp))) < asize) continue;
+                if (best == NULL || size < best_size) {
+                    best = bp;
+                    best_size = size;
+                }
+                if (--k == 0 || size == asize) return best;
+            }
+    return best != NULL ? best : tree_best_fit(asize);
+}
+
+/* scan_list - 链表中从 from 到 to (不含) 第一个放得下的块 */
+static char *scan_list(char *from, char *to, size_t asize) {
+    char *bp;
+
+    for (bp = from; bp != to; bp = SUCC(bp))
+        if (GET_SIZE(HDRP(bp)) >= asize) return bp;
     return NULL;
 }
+
+static void *first_fit(size_t asize) {
+    if (mm_freelist == MM_IMPLICIT) return scan_heap(NEXT_BLKP(heap_listp), NULL, asize, 1);
+    return scan_lists(asize, 1);
+}
+
+static void *best_fit(size_t asize) {
+    if (mm_freelist == MM_IMPLICIT) return scan_heap(NEXT_BLKP(heap_listp), NULL, asize, -1);
+    return scan_lists(asize, -1);
+}
+
+static void *good_fit(size_t asize) {
+    if (mm_freelist == MM_IMPLICIT)
+        return scan_heap(NEXT_BLKP(heap_listp), NULL, asize, MAX(mm_fit_k, 1));
+    return scan_lists(asize, MAX(mm_fit_k, 1));
+}
+
+/*
+ * next_fit - implicit 从 rover 找到堆尾再从头找到 rover；seglist 每一级从
+ *     seg_rover 找到表尾再从表头找回来，下次从找到的块的后继开始
+ */
+static void *next_fit(size_t asize) {
+    char *bp, *start;
+    int i;
+
+    if (mm_freelist == MM_IMPLICIT) {
+        if ((bp = scan_heap(rover, NULL, asize, 1)) == NULL &&
+            (bp = scan_heap(NEXT_BLKP(heap_listp), rover, asize, 1)) == NULL)
+            return NULL;
+        return rover = bp;
+    }
+
+    if (asize < TREE_MIN)
+        for (i = size_class(asize); i < NUM_CLASSES; i++) {
+            start = off2ptr(seg_rover[i]);
+            if ((bp = scan_list(start, NULL, asize)) != NULL ||
+                (bp = scan_list(off2ptr(seg_heads[i]), start, asize)) != NULL) {
+                seg_rover[i] = ptr2off(SUCC(bp));
+                return bp;
+            }
+        }
+    return tree_best_fit(asize);
+}
+
+/*
+ * insert_free - LIFO 插入到对应级别链表的表头，implicit 模式下什么都不做
+ */
+static void insert_free(void *bp) {
+    int i;
+    char *head;
+
+    if (mm_freelist == MM_IMPLICIT) return;
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_insert(bp);
+        return;
+    }
+
+    i = size_class(GET_SIZE(HDRP(bp)));
+    head = off2ptr(seg_heads[i]);
+    PUT(PRED_OFF(bp), 0);
+    PUT(SUCC_OFF(bp), ptr2off(head));
+    if (head != NULL) PUT(PRED_OFF(head), ptr2off(bp));
+    seg_heads[i] = ptr2off(bp);
+}
+
+static void remove_free(void *bp) {
+    char *pred, *succ;
+    int i;
+
+    if (mm_freelist == MM_IMPLICIT) return;
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_remove(bp);
+        return;
+    }
+
+    pred = PRED(bp);
+    succ = SUCC(bp);
+    i = size_class(GET_SIZE(HDRP(bp)));
+    if (seg_rover[i] == ptr2off(bp)) seg_rover[i] = ptr2off(succ);
+    if (pred != NULL)
+        PUT(SUCC_OFF(pred), ptr2off(succ));
+    else
+        seg_heads[i] = ptr2off(succ);
+    if (succ != NULL) PUT(PRED_OFF(succ), ptr2off(pred));
+}
+
+/*
+ * splay - 自顶向下伸展，返回新的根：大小等于 size 的结点，或者最后访问到的
+ *     前驱/后继。l/r 是拆出来的左树的最大结点和右树的最小结点。
+ */
+static char *splay(char *t, size_t size) {
+    char *l = NULL, *r = NULL, *lroot = NULL, *rroot = NULL, *y;
+
+    if (t == NULL) return NULL;
+    while (size != GET_SIZE(HDRP(t))) {
+        if (size < GET_SIZE(HDRP(t))) {
+            if ((y = LEFT(t)) == NULL) break;
+            if (size < GET_SIZE(HDRP(y))) {  // 右旋
+                SET_LEFT(t, RIGHT(y));
+                SET_RIGHT(y, t);
+                t = y;
+                if (LEFT(t) == NULL) break;
+            }
+            if (r != NULL)  // t 挂到右树
+                SET_LEFT(r, t);
+            else
+                rroot = t;
+            r = t;
+            t = LEFT(t);
+        } else {
+            if ((y = RIGHT(t)) == NULL) break;
+            if (size > GET_SIZE(HDRP(y))) {  // 左旋
+                SET_RIGHT(t, LEFT(y));
+                SET_LEFT(y, t);
+                t = y;
+                if (RIGHT(t) == NULL) break;
+            }
+            if (l != NULL)  // t 挂到左树
+                SET_RIGHT(l, t);
+            else
+                lroot = t;
+            l = t;
+            t = RIGHT(t);
+        }
+    }
+    // 重新组装
+    if (l != NULL) {
+        SET_RIGHT(l, LEFT(t));
+        SET_LEFT(t, lroot);
+    }
+    if (r != NULL) {
+        SET_LEFT(r, RIGHT(t));
+        SET_RIGHT(t, rroot);
+    }
+    return t;
+}
+
+/*
+ * tree_insert - 已经有同样大小的结点就挂到它后面，否则作为新的根
+ */
+static void tree_insert(char *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t;
+
+    SET_SAME_PREV(bp, NULL);
+    SET_SAME_NEXT(bp, NULL);
+    if (tree_root == NULL) {
+        SET_LEFT(bp, NULL);
+        SET_RIGHT(bp, NULL);
+        tree_root = bp;
+        return;
+    }
+    t = tree_root = splay(tree_root, size);
+    if (size == GET_SIZE(HDRP(t))) {
+        SET_SAME_PREV(bp, t);
+        SET_SAME_NEXT(bp, SAME_NEXT(t));
+        if (SAME_NEXT(t) != NULL) SET_SAME_PREV(SAME_NEXT(t), bp);
+        SET_SAME_NEXT(t, bp);
+        return;
+    }
+    if (size < GET_SIZE(HDRP(t))) {
+        SET_LEFT(bp, LEFT(t));
+        SET_RIGHT(bp, t);
+        SET_LEFT(t, NULL);
+    } else {
+        SET_RIGHT(bp, RIGHT(t));
+        SET_LEFT(bp, t);
+        SET_RIGHT(t, NULL);
+    }
+    tree_root = bp;
+}
+
+/*
+ * tree_remove - 挂在链表里的块 O(1) 摘下；树结点由链表里的下一个块顶替，
+ *     链表为空才真正从树中删除
+ */
+static void tree_remove(char *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t, *prev = SAME_PREV(bp), *next = SAME_NEXT(bp);
+
+    if (prev != NULL) {
+        SET_SAME_NEXT(prev, next);
+        if (next != NULL) SET_SAME_PREV(next, prev);
+        return;
+    }
+
+    t = splay(tree_root, size);  // t == bp
+    if (next != NULL) {
+        SET_LEFT(next, LEFT(t));
+        SET_RIGHT(next, RIGHT(t));
+        SET_SAME_PREV(next, NULL);
+        tree_root = next;
+    } else if (LEFT(t) == NULL) {
+        tree_root = RIGHT(t);
+    } else {  // 左子树的最大结点伸展上来，它没有右孩子
+        tree_root = splay(LEFT(t), size);
+        SET_RIGHT(tree_root, RIGHT(t));
+    }
+}
+
+/*
+ * tree_best_fit - 树中不小于 asize 的最小块，没有则返回 NULL。
+ *     优先返回挂在链表里的块，这样之后的 tree_remove 不用动树。
+ */
+static char *tree_best_fit(size_t asize) {
+    char *t;
+
+    if (tree_root == NULL) return NULL;
+    // 伸展后根是 asize 本身、它的前驱或后继
+    t = tree_root = splay(tree_root, asize);
+    if (GET_SIZE(HDRP(t)) < asize)
+        for (t = RIGHT(t); t != NULL && LEFT(t) != NULL; t = LEFT(t))
+            ;
+    if (t != NULL && SAME_NEXT(t) != NULL) return SAME_NEXT(t);
+    return t;
+}
+
+/*
+ * mm_heapstats - 从序言块走到结尾块，统计每类字节数和空闲块大小分布
+ */
+void mm_heapstats(mm_heapstats_t *st) {
+    char *bp;
+    size_t size;
+    unsigned int cls, used, nobjs;
+    int bin;
+
+    if (mm_concurrent) pthread_mutex_lock(&heap_lock);
+    memset(st, 0, sizeof(*st));
+    st->heap = mem_heapsize();
+    st->mapped = map_bytes;
+    st->alloc_blocks = map_count;
+    st->usable = map_bytes - map_count * DSIZE;
+    st->overhead = map_count * DSIZE + 4 * WSIZE;  // 对齐字、序言块、结尾块
+
+    for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp)) || (GET(HDRP(bp)) & QUICK)) {  // quick 块也算空闲
+            st->free_blocks++;
+            st->free_bytes += size;
+            st->largest_free = MAX(st->largest_free, size);
+            for (bin = 0; bin < MM_HIST_BINS - 1 && size >= (32u << bin); bin++)
+                ;
+            st->hist[bin]++;
+            continue;
+        }
+        st->alloc_blocks++;
+        if (!is_slab(bp)) {
+            st->usable += size - WSIZE;
+            st->overhead += WSIZE;
+            continue;
+        }
+        // run: 已分配对象算 usable，空位算 slab_free，其余都是开销
+        cls = GET(RUN_CLASS(bp));
+        used = GET(RUN_USED(bp));
+        nobjs = RUN_NOBJS(cls);
+        st->slab_objs += used;
+        st->usable += used * RUN_OBJSIZE(cls);
+        st->slab_free += (nobjs - used) * RUN_OBJSIZE(cls);
+        st->overhead += size - nobjs * RUN_OBJSIZE(cls);
+    }
+    if (mm_concurrent) pthread_mutex_unlock(&heap_lock);
+}
+
+/* is_free_block - bp 是否指向堆里的一个空闲块，用来检查链表里的指针 */
+static int is_free_block(char *bp) {
+    return bp > (char *)heap_listp && bp < (char *)mem_heap_hi() + 1 &&
+           (size_t)bp % ALIGNMENT == 0 && !GET_ALLOC(HDRP(bp));
+}
+
+static int check_fail(void *bp, const char *what) {
+    printf("mm_checkheap: block %p: %s\n", bp, what);
+    return 1;
+}
+
+/*
+ * check_tree - 检查以 t 为根的子树：结点大小在 (lo, hi) 之间，同样大小的
+ *     链表前后指针一致。返回子树里的块数，超过 budget 说明有环，不再往下走
+ */
+static size_t check_tree(char *t, size_t lo, size_t hi, size_t budget, int *errs) {
+    size_t size, n = 1;
+    char *c, *prev;
+
+    if (t == NULL) return 0;
+    if (!is_free_block(t)) {
+        *errs += check_fail(t, "tree node is not a free block");
+        return budget + 1;
+    }
+    size = GET_SIZE(HDRP(t));
+    if (size < TREE_MIN || size <= lo || size >= hi) *errs += check_fail(t, "tree node out of order");
+    for (prev = t, c = SAME_NEXT(t); c != NULL && n <= budget; prev = c, c = SAME_NEXT(c), n++) {
+        if (!is_free_block(c) || GET_SIZE(HDRP(c)) != size) {
+            *errs += check_fail(c, "same-size chain holds a different block");
+            return budget + 1;
+        }
+        if (SAME_PREV(c) != prev) *errs += check_fail(c, "same-size chain prev link is wrong");
+    }
+    if (n > budget) return n;
+    n += check_tree(LEFT(t), lo, size, budget - n, errs);
+    if (n > budget) return n;
+    return n + check_tree(RIGHT(t), size, hi, budget - n, errs);
+}
+
+/*
+ * check_run - slab run 的级别合法，已分配对象数和 bitmap 一致
+ */
+static int check_run(char *r) {
+    unsigned int cls = GET(RUN_CLASS(r)), used = 0, i;
+
+    if (cls >= SLAB_CLASSES) return check_fail(r, "slab run has a bad size class");
+    for (i = 0; i < RUN_NOBJS(cls); i++)  // 超出对象个数的位总是 1，不算
+        used += (RUN_BITMAP(r)[i / 32] >> (i % 32)) & 1;
+    if (used != GET(RUN_USED(r)))
+        return check_fail(r, "slab run count disagrees with its bitmap");
+    return 0;
+}
+
+/*
+ * mm_checkheap - 检查堆的一致性，返回发现的问题数，每个问题打印一行；
+ *     verbose 非 0 时同时打印每个块
+ */
+int mm_checkheap(int verbose) {
+    char *bp, *prev = heap_listp, *end = (char *)mem_heap_hi() + 1;
+    size_t size, nfree = 0, nquick = 0, qbytes = 0, n;
+    int errs = 0, i;
+
+    if (mm_concurrent) pthread_mutex_lock(&heap_lock);
+    if (GET(HDRP(heap_listp)) != PACK(DSIZE, 1) || GET(FTRP(heap_listp)) != PACK(DSIZE, 1))
+        errs += check_fail(heap_listp, "bad prologue");
+
+    // 按地址走一遍堆，quick 块在堆里是已分配的
+    for (bp = NEXT_BLKP(heap_listp); (size = GET_SIZE(HDRP(bp))) > 0; prev = bp, bp = NEXT_BLKP(bp)) {
+        if (verbose)
+            printf("%p: %s, size %lu%s\n", bp, GET_ALLOC(HDRP(bp)) ? "allocated" : "free",
+                   (unsigned long)size, (GET(HDRP(bp)) & QUICK) ? ", quick" : "");
+        if ((size_t)bp % ALIGNMENT != 0) errs += check_fail(bp, "payload is not aligned");
+        if (size < 2 * DSIZE || bp + size > end) {  // 后面的块都找不到了
+            errs += check_fail(bp, "bad block size");
+            break;
+        }
+        if (!GET_PREV_ALLOC(HDRP(bp)) != !GET_ALLOC(HDRP(prev)))
+            errs += check_fail(bp, "prev_alloc bit disagrees with the previous block");
+        if (GET_ALLOC(HDRP(bp))) {
+            if (GET(HDRP(bp)) & QUICK) {
+                nquick++;
+                qbytes += size;
+            }
+            if (is_slab(bp)) errs += check_run(bp);
+            continue;
+        }
+        nfree++;
+        if (GET_SIZE(FTRP(bp)) != size || GET_ALLOC(FTRP(bp)))
+            errs += check_fail(bp, "header and footer disagree");
+        if (!GET_ALLOC(HDRP(prev))) errs += check_fail(bp, "not coalesced with the previous free block");
+        if (GET(HDRP(bp)) & QUICK) errs += check_fail(bp, "free block has the quick bit");
+    }
+    if (size == 0 && (bp != end || !GET_ALLOC(HDRP(bp)))) errs += check_fail(bp, "bad epilogue");
+
+    // quick list 里正好是堆里带 QUICK 位的那些块
+    for (i = 0, n = 0; i < QUICK_BINS; i++)
+        for (bp = off2ptr(quick_heads[i]); bp != NULL; bp = off2ptr(GET(bp))) {
+            if (++n > nquick || bp <= (char *)heap_listp || bp >= end || !(GET(HDRP(bp)) & QUICK)) {
+                errs += check_fail(bp, "quick list holds a block that is not quick");
+                break;
+            }
+            if (GET_SIZE(HDRP(bp)) != (size_t)(i + 2) * DSIZE)
+                errs += check_fail(bp, "quick block is in the wrong bin");
+        }
+    if (n != nquick || qbytes != quick_bytes)
+        errs += check_fail(NULL, "quick lists and heap disagree");
+
+    // 每个空闲块恰好在一个链表或树里
+    if (mm_freelist == MM_SEGLIST) {
+        n = 0;
+        for (i = 0; i < NUM_CLASSES; i++)
+            for (prev = NULL, bp = off2ptr(seg_heads[i]); bp != NULL; prev = bp, bp = SUCC(bp)) {
+                if (++n > nfree || !is_free_block(bp)) {
+                    errs += check_fail(bp, "free list holds a block that is not free");
+                    break;
+                }
+                if (PRED(bp) != prev) errs += check_fail(bp, "free list pred link is wrong");
+                size = GET_SIZE(HDRP(bp));
+                if (size >= TREE_MIN || size_class(size) != i)
+                    errs += check_fail(bp, "free block is in the wrong size class");
+            }
+        if (tree_root != NULL && SAME_PREV(tree_root) != NULL)
+            errs += check_fail(tree_root, "tree root is on a same-size chain");
+        if (n <= nfree) n += check_tree(tree_root, 0, (size_t)-1, nfree - n, &errs);
+        if (n != nfree) errs += check_fail(NULL, "free lists and heap disagree");
+    }
+    if (mm_concurrent) pthread_mutex_unlock(&heap_lock);
+    return errs;
+}
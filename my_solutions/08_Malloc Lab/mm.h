@@ -4,6 +4,92 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+
+/*
+ * Free block organization, selected at runtime before mm_init()
+ */
+#define MM_IMPLICIT 0 /* implicit list, first-fit walk over every block */
+#define MM_SEGLIST  1 /* segregated explicit free lists by size class */
+extern int mm_freelist;
+
+/*
+ * Placement policy, selected at runtime before mm_init(). MM_GOOD_FIT is
+ * a bounded best fit: the smallest of the first mm_fit_k blocks that fit.
+ */
+#define MM_FIRST_FIT 0
+#define MM_NEXT_FIT  1 /* first fit starting where the last search stopped */
+#define MM_BEST_FIT  2
+#define MM_GOOD_FIT  3
+#define MM_NUM_FITS  4
+extern int mm_fit;
+extern int mm_fit_k;
+
+/*
+ * Nonzero makes mm_malloc/mm_free/mm_realloc safe to call from several
+ * threads at once (per-thread caches in front of a locked heap). Set it
+ * before mm_init().
+ */
+extern int mm_concurrent;
+
+/*
+ * Nonzero serves requests of at most 64 bytes from page-sized slab runs
+ * with no per-object header. Set it before mm_init().
+ */
+extern int mm_slab;
+
+/*
+ * A free block at the end of the heap that grows past mm_trim_threshold
+ * bytes is cut back to that size with a negative mem_sbrk (0 disables).
+ * Free blocks of at least mm_release_threshold bytes hand their payload
+ * pages back with mem_release (0, the default, disables).
+ */
+extern size_t mm_trim_threshold;
+extern size_t mm_release_threshold;
+
+/*
+ * Requests of at least mm_mmap_threshold bytes get their own region from
+ * mem_map instead of the heap, and go back to the OS on free (0 disables).
+ */
+extern size_t mm_mmap_threshold;
+
+/*
+ * Nonzero defers coalescing: freed blocks of up to 1 KB wait on
+ * exact-size quick lists for a request of the same size, and are merged
+ * in one batch when a request finds no fit or more than mm_defer_limit
+ * bytes are waiting.
+ */
+extern size_t mm_defer_limit;
+
+/*
+ * Heap layout snapshot filled in by mm_heapstats() for the driver's
+ * fragmentation report (mdriver -H). Every byte of the heap and of the
+ * mapped regions lands in exactly one of usable, overhead, free_bytes
+ * and slab_free.
+ */
+#define MM_HIST_BINS 16 /* free sizes [16,32), [32,64), ..., [512K,inf) */
+typedef struct {
+    size_t heap;           /* mem_heapsize() */
+    size_t mapped;         /* bytes in regions from mem_map */
+    size_t alloc_blocks;   /* allocated blocks, mapped ones included */
+    size_t usable;         /* bytes that payloads may use in them */
+    size_t overhead;       /* headers, prologue/epilogue, slab run headers */
+    size_t slab_objs;      /* live slab objects (part of usable) */
+    size_t slab_free;      /* empty object slots in slab runs */
+    size_t free_blocks;    /* free blocks in the heap */
+    size_t free_bytes;     /* their total size */
+    size_t largest_free;   /* the largest of them */
+    size_t hist[MM_HIST_BINS]; /* free block counts by size */
+} mm_heapstats_t;
+extern void mm_heapstats(mm_heapstats_t *st);
+
+/*
+ * Walks the heap and the free lists and prints one line per
+ * inconsistency it finds (every block, too, if verbose). Returns the
+ * number of inconsistencies, 0 for a good heap.
+ */
+extern int mm_checkheap(int verbose);
 
 
 /* 
@@ -0,0 +1,520 @@
+/*
+ * mmgen.c - Generate a synthetic .rep trace from size and lifetime
+ *     distributions
+ *
+ * usage: mmgen [options] <out.rep>
+ *
+ * A trace is made of one or more phases. The options before each -n
+ * describe a phase, and -n ends it with the number of requests it
+ * should have; a later phase starts from the settings of the one
+ * before it. So
+ *
+ *     unix> mmgen -s exp:64 -l exp:2000 -n 5M -s pow2:4K:256K -n 1M big.rep
+ *
+ * writes 5 million requests of small, mostly short-lived blocks, then
+ * a million requests whose new blocks are large. The blocks of the
+ * first phase still die on their own schedule in the second one.
+ *
+ * Time advances by one tick per allocation. Each block gets a lifetime
+ * in ticks when it is allocated, and is freed when its time is up. A
+ * growing block also gets a few reallocs spread over its lifetime.
+ * Whatever is still allocated when the last phase ends is freed in
+ * order of death, so every block is freed by the end of the trace.
+ *
+ * A distribution is one of
+ *     N                  always N
+ *     uniform:LO:HI      uniform in [LO, HI]
+ *     exp:MEAN           exponential with the given mean
+ *     lognormal:MED:SIG  lognormal with median MED and shape SIG
+ *     pow2:LO:HI         a power of two in [LO, HI], uniform in log
+ * and numbers may end in K or M. A size is rounded to a whole number of
+ * bytes in [1, TRACE_MAX_SIZE], a lifetime to at least one tick.
+ *
+ * Events sit in a binary heap ordered by time, so the generator takes
+ * O(log n) time per request, and memory in proportion to the number of
+ * live blocks plus four bytes per block id. Every event in the heap
+ * belongs to a live block, so an "e" line just empties the heap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "tracefmt.h"
+
+#define MAXPHASES 64          /* most phases on one command line */
+#define HDRWIDTH  12          /* header fields are patched in place */
+#define FOREVER   UINT64_MAX  /* death time of a long-lived block */
+
+/* A distribution of sizes or lifetimes */
+typedef struct {
+    enum {D_FIXED, D_UNIFORM, D_EXP, D_LOGNORM, D_POW2} kind;
+    double a, b;
+} dist_t;
+
+/* How a growing block changes size at each realloc */
+enum {G_DOUBLE, G_ADD, G_RANDOM};
+
+/* The settings of one phase */
+typedef struct {
+    long nops;          /* requests in the phase */
+    dist_t size;        /* -s: sizes of new blocks */
+    dist_t life;        /* -l: lifetimes of new blocks, in ticks */
+    double forever;     /* -L: fraction of blocks that are never freed early */
+    double calloc_frac; /* -c: fraction of allocations that are callocs */
+    double grow_frac;   /* -r: fraction of blocks that are reallocated */
+    int grow;           /* -g: G_DOUBLE, G_ADD or G_RANDOM */
+    unsigned grow_add;  /* bytes a G_ADD realloc adds */
+    int max_reallocs;   /* -k: a growing block gets 1..k reallocs */
+    long epoch;         /* -e: emit an "e" line every epoch requests, 0: never */
+} phase_t;
+
+/* A pending realloc or free of one block */
+typedef struct {
+    uint64_t time;
+    uint32_t id;
+    uint32_t type;      /* REALLOC or FREE; reallocs sort first */
+} event_t;
+
+static phase_t phases[MAXPHASES];
+static int nphases = 0;
+
+static event_t *heap = NULL;   /* min-heap of events by (time, type) */
+static size_t heap_n = 0, heap_max = 0;
+
+static uint32_t *sizes = NULL;      /* current payload size of each id */
+static size_t max_ids = 0;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/*
+ * app_error - Report an error and terminate
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "mmgen: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmgen [options] <out.rep>\n");
+    fprintf(stderr, "Options (each -n ends a phase, later phases inherit):\n");
+    fprintf(stderr, "\t-s <dist>   Sizes of new blocks (default exp:128).\n");
+    fprintf(stderr, "\t-l <dist>   Lifetimes, in allocations (default exp:1000).\n");
+    fprintf(stderr, "\t-L <frac>   Fraction of blocks that live until the end (default 0).\n");
+    fprintf(stderr, "\t-c <frac>   Fraction of allocations made by calloc (default 0).\n");
+    fprintf(stderr, "\t-r <frac>   Fraction of blocks that are reallocated (default 0).\n");
+    fprintf(stderr, "\t-g <grow>   Realloc growth: double, add:N or random (default double).\n");
+    fprintf(stderr, "\t-k <n>      A reallocated block gets 1..n reallocs (default 4).\n");
+    fprintf(stderr, "\t-e <n>      Free every block with an \"e\" line every n requests.\n");
+    fprintf(stderr, "\t-n <n>      End the phase after n requests (default 100K).\n");
+    fprintf(stderr, "\t-S <seed>   Seed the random number generator.\n");
+    fprintf(stderr, "dist: N, uniform:LO:HI, exp:MEAN, lognormal:MED:SIG, pow2:LO:HI\n");
+}
+
+/*
+ * rng - xorshift64*, so a seed gives the same trace everywhere
+ */
+static uint64_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+/* A double uniform in [0, 1) */
+static double rng_unit(void)
+{
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * parse_num - Parse a number with an optional K or M suffix. Returns -1
+ *     if s isn't one.
+ */
+static double parse_num(char *s, char **end)
+{
+    double v = strtod(s, end);
+
+    if (*end == s)
+	return -1;
+    if (**end == 'K' || **end == 'k')
+	v *= 1024, (*end)++;
+    else if (**end == 'M' || **end == 'm')
+	v *= 1024 * 1024, (*end)++;
+    return v;
+}
+
+/*
+ * parse_dist - Parse a distribution spec into d. Returns -1 if it is
+ *     malformed.
+ */
+static int parse_dist(char *spec, dist_t *d)
+{
+    static const struct { char *name; int kind; int nargs; } kinds[] = {
+	{"uniform", D_UNIFORM, 2}, {"exp", D_EXP, 1},
+	{"lognormal", D_LOGNORM, 2}, {"pow2", D_POW2, 2},
+    };
+    char *colon, *s, *end;
+    double args[2];
+    int i, k, n;
+
+    if ((colon = strchr(spec, ':')) == NULL) {
+	d->kind = D_FIXED;
+	d->a = parse_num(spec, &end);
+	return (d->a < 0 || *end != '\0') ? -1 : 0;
+    }
+    for (k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++)
+	if (strlen(kinds[k].name) == (size_t)(colon - spec) &&
+	    strncmp(spec, kinds[k].name, colon - spec) == 0)
+	    break;
+    if (k == (int)(sizeof(kinds) / sizeof(kinds[0])))
+	return -1;
+
+    s = colon + 1;
+    for (n = 0; n < kinds[k].nargs; n++) {
+	if ((args[n] = parse_num(s, &end)) < 0)
+	    return -1;
+	s = end;
+	if (n + 1 < kinds[k].nargs && *s++ != ':')
+	    return -1;
+    }
+    if (*s != '\0')
+	return -1;
+
+    d->kind = kinds[k].kind;
+    d->a = args[0];
+    d->b = (kinds[k].nargs > 1) ? args[1] : 0;
+    if ((d->kind == D_UNIFORM || d->kind == D_POW2) && d->a > d->b)
+	return -1;
+    if (d->kind == D_POW2 && d->a < 1)
+	d->a = 1;
+    if (d->kind == D_POW2) {
+	for (i = 0; (1ULL << i) < d->a; i++)
+	    ;
+	if ((1ULL << i) > d->b)  /* no power of two in the range */
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * sample - Draw one value from d
+ */
+static double sample(dist_t *d)
+{
+    double u, v;
+    int lo, hi;
+
+    switch (d->kind) {
+    case D_UNIFORM:
+	return d->a + rng_unit() * (d->b - d->a + 1);
+    case D_EXP:
+	return -d->a * log(1.0 - rng_unit());
+    case D_LOGNORM:
+	/* Box-Muller for the normal variate */
+	u = 1.0 - rng_unit();
+	v = rng_unit();
+	return d->a * exp(d->b * sqrt(-2.0 * log(u)) * cos(2 * M_PI * v));
+    case D_POW2:
+	lo = (int)ceil(log2(d->a));
+	hi = (int)floor(log2(d->b));
+	return (double)(1ULL << (lo + rng() % (hi - lo + 1)));
+    default:
+	return d->a;
+    }
+}
+
+/* A payload size in [1, TRACE_MAX_SIZE] */
+static uint32_t clamp_size(double x)
+{
+    if (x < 1)
+	return 1;
+    if (x > TRACE_MAX_SIZE)
+	return TRACE_MAX_SIZE;
+    return (uint32_t)x;
+}
+
+/*
+ * push, pop - The event heap
+ */
+static int before(event_t *x, event_t *y)
+{
+    return x->time < y->time ||
+	(x->time == y->time && x->type == REALLOC && y->type == FREE);
+}
+
+static void push(uint64_t time, uint32_t id, uint32_t type)
+{
+    size_t i, parent;
+    event_t e;
+
+    if (heap_n == heap_max) {
+	heap_max = heap_max ? 2 * heap_max : 4096;
+	if ((heap = realloc(heap, heap_max * sizeof(event_t))) == NULL)
+	    app_error("Out of memory");
+    }
+    e.time = time;
+    e.id = id;
+    e.type = type;
+    for (i = heap_n++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (!before(&e, &heap[parent]))
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i] = e;
+}
+
+static event_t pop(void)
+{
+    event_t top = heap[0], last = heap[--heap_n];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < heap_n) {
+	if (child + 1 < heap_n && before(&heap[child + 1], &heap[child]))
+	    child++;
+	if (!before(&heap[child], &last))
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * new_id - Make room for one more block id
+ */
+static uint32_t new_id(uint32_t id)
+{
+    if (id >= max_ids) {
+	max_ids = max_ids ? 2 * max_ids : 65536;
+	if ((sizes = realloc(sizes, max_ids * sizeof(uint32_t))) == NULL)
+	    app_error("Out of memory");
+    }
+    return id;
+}
+
+/*
+ * regrow - The next size of a growing block under the phase's pattern
+ */
+static uint32_t regrow(phase_t *p, uint32_t size)
+{
+    switch (p->grow) {
+    case G_ADD:
+	return clamp_size((double)size + p->grow_add);
+    case G_RANDOM:
+	return clamp_size(size * (0.5 + 1.5 * rng_unit()));
+    default:
+	return clamp_size(2.0 * size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    phase_t cur;
+    phase_t *p;
+    event_t e;
+    FILE *out;
+    char *end;
+    char msg[256];
+    char c;
+    uint64_t now = 0, death;
+    uint32_t id, num_ids = 0;
+    unsigned long long num_ops = 0, live_bytes = 0, peak_bytes = 0;
+    long done, since_epoch;
+    int i, j, k, pending = 0;
+    double v;
+
+    memset(&cur, 0, sizeof(cur));
+    cur.size.kind = D_EXP;
+    cur.size.a = 128;
+    cur.life.kind = D_EXP;
+    cur.life.a = 1000;
+    cur.grow = G_DOUBLE;
+    cur.max_reallocs = 4;
+
+    while ((c = getopt(argc, argv, "s:l:L:c:r:g:k:e:n:S:h")) != EOF) {
+	switch (c) {
+	case 's':
+	    if (parse_dist(optarg, &cur.size) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'l':
+	    if (parse_dist(optarg, &cur.life) < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'L':
+	case 'c':
+	case 'r':
+	    v = atof(optarg);
+	    if (v < 0 || v > 1) {
+		usage();
+		exit(1);
+	    }
+	    if (c == 'L')
+		cur.forever = v;
+	    else if (c == 'c')
+		cur.calloc_frac = v;
+	    else
+		cur.grow_frac = v;
+	    break;
+	case 'g':
+	    if (!strcmp(optarg, "double"))
+		cur.grow = G_DOUBLE;
+	    else if (!strcmp(optarg, "random"))
+		cur.grow = G_RANDOM;
+	    else if (!strncmp(optarg, "add:", 4) &&
+		     (v = parse_num(optarg + 4, &end)) > 0 && *end == '\0') {
+		cur.grow = G_ADD;
+		cur.grow_add = (unsigned)v;
+	    }
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'k':
+	    if ((cur.max_reallocs = atoi(optarg)) < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'e':
+	    cur.epoch = (long)parse_num(optarg, &end);
+	    if (cur.epoch < 0 || *end != '\0') {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'n':
+	    cur.nops = (long)parse_num(optarg, &end);
+	    if (cur.nops < 1 || *end != '\0' || nphases == MAXPHASES) {
+		usage();
+		exit(1);
+	    }
+	    phases[nphases++] = cur;
+	    pending = -1;
+	    break;
+	case 'S':  /* for the whole trace, not a phase */
+	    rng_state = strtoull(optarg, NULL, 0) * 0x9e3779b97f4a7c15ULL + 1;
+	    continue;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+	pending++;  /* settings since the last -n */
+    }
+    if (optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+    if (nphases == 0) {  /* no -n: one phase of 100K requests */
+	cur.nops = 100000;
+	phases[nphases++] = cur;
+    }
+    else if (pending > 0)
+	app_error("Settings after the last -n would be ignored");
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+	sprintf(msg, "Could not create %s", argv[optind]);
+	app_error(msg);
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    /* Leave room for the header, which is only known at the end */
+    fprintf(out, "%*s\n%*s\n%*s\n%*s\n", HDRWIDTH, "", HDRWIDTH, "",
+	    HDRWIDTH, "", HDRWIDTH, "");
+
+    for (i = 0; i < nphases; i++) {
+	p = &phases[i];
+	done = since_epoch = 0;
+	while (done < p->nops) {
+	    /* The requests that are due by now */
+	    while (heap_n > 0 && heap[0].time <= now && done < p->nops) {
+		e = pop();
+		live_bytes -= sizes[e.id];
+		if (e.type == REALLOC) {
+		    sizes[e.id] = regrow(p, sizes[e.id]);
+		    live_bytes += sizes[e.id];
+		    fprintf(out, "r %u %u\n", e.id, sizes[e.id]);
+		}
+		else
+		    fprintf(out, "f %u\n", e.id);
+		done++;
+	    }
+	    if (done >= p->nops)
+		break;
+
+	    /* Then one new block */
+	    id = new_id(num_ids++);
+	    sizes[id] = clamp_size(sample(&p->size));
+	    live_bytes += sizes[id];
+	    if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	    if (rng_unit() < p->calloc_frac)
+		fprintf(out, "c %u %u\n", id, sizes[id]);
+	    else
+		fprintf(out, "a %u %u\n", id, sizes[id]);
+	    done++;
+	    now++;
+
+	    if (rng_unit() < p->forever)
+		death = FOREVER;
+	    else {
+		v = sample(&p->life);
+		death = now + (v < 1 ? 1 : (uint64_t)v);
+	    }
+	    push(death, id, FREE);
+	    if (death != FOREVER && rng_unit() < p->grow_frac) {
+		k = 1 + rng() % p->max_reallocs;
+		for (j = 1; j <= k; j++)
+		    push(now + (death - now) * j / (k + 1), id, REALLOC);
+	    }
+
+	    /* Batches that die together end in an "e" line */
+	    if (p->epoch && ++since_epoch >= p->epoch && done < p->nops) {
+		fprintf(out, "e\n");
+		heap_n = 0;
+		live_bytes = 0;
+		since_epoch = 0;
+		done++;
+	    }
+	}
+	num_ops += done;
+    }
+
+    /* Free what is left, in order of death */
+    while (heap_n > 0) {
+	if ((e = pop()).type == FREE) {
+	    fprintf(out, "f %u\n", e.id);
+	    num_ops++;
+	}
+    }
+
+    if (num_ids == 0)
+	app_error("The trace has no allocations");
+    rewind(out);
+    if (peak_bytes > INT32_MAX)  /* sugg_heapsize is an int */
+	peak_bytes = INT32_MAX;
+    fprintf(out, "%*llu\n%*u\n%*llu\n%*d", HDRWIDTH, peak_bytes,
+	    HDRWIDTH, num_ids, HDRWIDTH, num_ops, HDRWIDTH, 1);
+    if (fclose(out) != 0)
+	app_error("Write failed");
+    return 0;
+}
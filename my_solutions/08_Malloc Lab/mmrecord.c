@@ -0,0 +1,583 @@
+/*
+ * mmrecord.c - Record the allocations of a real process as a .rep trace
+ *
+ * Build mmrecord.so with "make mmrecord.so" and run the program to be
+ * recorded under it:
+ *
+ *     unix> MMRECORD_OUT=ls.rep LD_PRELOAD=./mmrecord.so ls -l
+ *     unix> mdriver -V -f ls.rep
+ *
+ * The shim interposes malloc, calloc, realloc, free and the memalign
+ * family. valloc, pvalloc and reallocarray are not interposed: glibc
+ * serves them without going through the interposed functions, so their
+ * blocks are missing from the trace and their frees are dropped like
+ * those of blocks allocated before recording started.
+ *
+ * Each thread appends fixed-size events to its own buffer. A single
+ * atomic counter stamps each event with a sequence number, and that
+ * stamp is the only shared write on the fast path. A full buffer is
+ * written to a raw log (MMRECORD_OUT.raw) with one write() call. When
+ * the process exits, the raw log is sorted by sequence number and
+ * turned into a .rep file:
+ *   - pointers become dense ids, and a realloc keeps the id of its block
+ *   - calloc is recorded as a "c" request, and the memalign family as
+ *     an "m" request carrying its alignment; alignments of at most 8 or
+ *     above 32 KB are recorded as plain allocations
+ *   - malloc(0) is recorded as a 1-byte request, since mdriver rejects
+ *     empty payloads
+ *   - realloc(p, 0) is recorded as a free
+ *   - requests larger than TRACE_MAX_SIZE, which mdriver rejects, are
+ *     skipped with a warning; a realloc that grows a block past it is
+ *     recorded as a free of the block
+ *   - frees of blocks allocated before recording started are dropped
+ * The sugg_heapsize header field gets the peak number of live payload
+ * bytes.
+ *
+ * A free is stamped before the block goes back to libc, and an
+ * allocation after libc hands it out. So another thread can never reuse
+ * an address before its free is ordered. The only exception is the old
+ * block of a moving realloc. If another thread allocates that address
+ * before the realloc is stamped, the allocation lands on an address that
+ * is still live. The id that held that address is then forgotten, and it
+ * stays allocated in the replay.
+ *
+ * Events of threads that are still running at exit are flushed on a
+ * best-effort basis. A forked child stops recording.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tracefmt.h"
+
+#define EVENTS_PER_BUF 4096       /* events a thread buffers between writes */
+#define BOOT_HEAP      (64*1024)  /* serves dlsym's allocations at startup */
+#define MAXLINE        1024       /* max string size */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* Event types in the raw log */
+enum {EV_ALLOC, EV_FREE, EV_REALLOC, EV_CALLOC, EV_MEMALIGN};
+
+/* One allocator call, as written to the raw log */
+typedef struct {
+    uint64_t seq;   /* global order of the call */
+    uintptr_t ptr;  /* block returned, or block freed */
+    uintptr_t old;  /* block passed to realloc */
+    uint64_t size;  /* requested bytes */
+    uint32_t type;  /* EV_ALLOC, EV_FREE, ... */
+    uint32_t align; /* alignment asked of memalign, else 0 */
+} event_t;
+
+/* A thread's event buffer, linked into a global list for the final flush */
+typedef struct evbuf {
+    struct evbuf *next;
+    struct evbuf *prev;
+    int n;
+    event_t ev[EVENTS_PER_BUF];
+} evbuf_t;
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+
+static int recording = 0;           /* set once the raw log is open */
+static int raw_fd = -1;             /* raw event log */
+static char out_path[MAXLINE];      /* .rep file to produce */
+static char raw_path[MAXLINE];      /* raw log next to it */
+static uint64_t next_seq = 0;       /* global event counter */
+static evbuf_t *all_bufs = NULL;    /* every live thread's buffer */
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER; /* guards all_bufs */
+static pthread_key_t buf_key;       /* frees a buffer at thread exit */
+
+static char boot_heap[BOOT_HEAP];   /* bump allocator used while resolving */
+static size_t boot_used = 0;
+
+static TLS evbuf_t *my_buf = NULL;  /* this thread's buffer */
+static TLS int in_hook = 0;         /* set while the shim itself allocates */
+
+/*
+ * boot_alloc - Serve allocations made by dlsym before the real
+ *     allocator is known. These blocks are never freed.
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_HEAP)
+	return NULL;
+    p = boot_heap + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static int is_boot(void *p)
+{
+    return (char *)p >= boot_heap && (char *)p < boot_heap + BOOT_HEAP;
+}
+
+/*
+ * resolve - Look up the next definitions of the allocator functions
+ */
+static void resolve(void)
+{
+    static int resolving = 0;
+
+    if (real_malloc != NULL || resolving)
+	return;
+    resolving = 1;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    resolving = 0;
+}
+
+/*
+ * write_all - write() that retries short writes
+ */
+static void write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(fd, p, len)) <= 0)
+	    return;
+	p += n;
+	len -= n;
+    }
+}
+
+/*
+ * flush_buf - Append a buffer's events to the raw log. One write() per
+ *     buffer keeps threads from interleaving inside an event.
+ */
+static void flush_buf(evbuf_t *b)
+{
+    if (b->n > 0 && raw_fd >= 0)
+	write_all(raw_fd, b->ev, b->n * sizeof(event_t));
+    b->n = 0;
+}
+
+/*
+ * thread_exit - pthread key destructor: flush the exiting thread's
+ *     buffer, take it off the list and unmap it, so that a program that
+ *     starts a thread per request doesn't leak a buffer per thread. If
+ *     a later destructor allocates, get_buf makes a new buffer and
+ *     registers it again.
+ */
+static void thread_exit(void *arg)
+{
+    evbuf_t *b = arg;
+
+    pthread_mutex_lock(&bufs_lock);
+    flush_buf(b);
+    if (b->prev != NULL)
+	b->prev->next = b->next;
+    else if (all_bufs == b)
+	all_bufs = b->next;
+    if (b->next != NULL)
+	b->next->prev = b->prev;
+    pthread_mutex_unlock(&bufs_lock);
+    if (my_buf == b)
+	my_buf = NULL;
+    munmap(b, sizeof(evbuf_t));
+}
+
+/*
+ * get_buf - Return this thread's buffer, creating it on first use. The
+ *     buffer comes from mmap so that creating it records nothing.
+ */
+static evbuf_t *get_buf(void)
+{
+    evbuf_t *b;
+
+    if ((b = my_buf) != NULL)
+	return b;
+    b = mmap(NULL, sizeof(evbuf_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+	return NULL;
+    b->n = 0;
+    b->prev = NULL;
+    pthread_mutex_lock(&bufs_lock);
+    b->next = all_bufs;
+    if (all_bufs != NULL)
+	all_bufs->prev = b;
+    all_bufs = b;
+    pthread_mutex_unlock(&bufs_lock);
+    my_buf = b;
+    in_hook = 1; /* pthread_setspecific may allocate */
+    pthread_setspecific(buf_key, b);
+    in_hook = 0;
+    return b;
+}
+
+/*
+ * record - Append one event to this thread's buffer
+ */
+static void record(int type, void *ptr, void *old, size_t size,
+		   size_t align)
+{
+    evbuf_t *b;
+    event_t *e;
+
+    if (!recording || in_hook || (b = get_buf()) == NULL)
+	return;
+    e = &b->ev[b->n];
+    e->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    e->type = type;
+    e->ptr = (uintptr_t)ptr;
+    e->old = (uintptr_t)old;
+    e->size = size;
+    e->align = align;
+    if (++b->n == EVENTS_PER_BUF)
+	flush_buf(b);
+}
+
+/*
+ * The interposed allocator
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    resolve();
+    if (real_malloc == NULL)
+	return boot_alloc(size);
+    if ((p = real_malloc(size)) != NULL)
+	record(EV_ALLOC, p, NULL, size, 0);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    resolve();
+    if (real_calloc == NULL)
+	return boot_alloc(nmemb * size); /* already zero */
+    if ((p = real_calloc(nmemb, size)) != NULL)
+	record(EV_CALLOC, p, NULL, nmemb * size, 0);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    resolve();
+    if (ptr == NULL)
+	return malloc(size);
+    if (is_boot(ptr)) {       /* move boot blocks out without recording */
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, MIN(size, boot_heap + BOOT_HEAP - (char *)ptr));
+	return p;
+    }
+    if (size == 0) {
+	free(ptr);
+	return NULL;
+    }
+    if ((p = real_realloc(ptr, size)) != NULL)
+	record(EV_REALLOC, p, ptr, size, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr))
+	return;
+    resolve();
+    record(EV_FREE, ptr, NULL, 0, 0);
+    real_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+
+    resolve();
+    if ((p = real_memalign(alignment, size)) != NULL) {
+	if (alignment > 8 && alignment <= 32768)
+	    record(EV_MEMALIGN, p, NULL, size, alignment);
+	else
+	    record(EV_ALLOC, p, NULL, size, 0);
+    }
+    return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if ((p = memalign(alignment, size)) == NULL)
+	return 12; /* ENOMEM */
+    *memptr = p;
+    return 0;
+}
+
+/*****************************************************************
+ * Converting the raw log to a .rep trace at exit. Recording is off
+ * by then, so the conversion itself uses the real allocator.
+ ****************************************************************/
+
+/* Live block table: open addressing on the block address */
+typedef struct {
+    uintptr_t ptr; /* 0 for an empty slot */
+    int id;
+    size_t size;
+} slot_t;
+
+static slot_t *table;
+static size_t table_mask;
+
+static size_t slot_of(uintptr_t ptr)
+{
+    return (size_t)((ptr >> 4) * 0x9E3779B97F4A7C15ULL) & table_mask;
+}
+
+static slot_t *lookup(uintptr_t ptr)
+{
+    size_t i;
+
+    for (i = slot_of(ptr); table[i].ptr != 0; i = (i + 1) & table_mask)
+	if (table[i].ptr == ptr)
+	    return &table[i];
+    return NULL;
+}
+
+static void insert(uintptr_t ptr, int id, size_t size)
+{
+    size_t i;
+
+    for (i = slot_of(ptr); table[i].ptr != 0; i = (i + 1) & table_mask)
+	;
+    table[i].ptr = ptr;
+    table[i].id = id;
+    table[i].size = size;
+}
+
+/*
+ * delete - Empty slot s, moving later entries of its probe run back so
+ *     that lookups never stop early
+ */
+static void delete(slot_t *s)
+{
+    size_t i = s - table, j = i, k;
+
+    for (;;) {
+	table[i].ptr = 0;
+	do {
+	    j = (j + 1) & table_mask;
+	    if (table[j].ptr == 0)
+		return;
+	    k = slot_of(table[j].ptr);
+	} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+	table[i] = table[j];
+	i = j;
+    }
+}
+
+static int by_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const event_t *)a)->seq, y = ((const event_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+/*
+ * emit_rep - Turn the n events of ev into the .rep file at out_path
+ */
+static void emit_rep(event_t *ev, size_t n)
+{
+    FILE *out;
+    char *ops;         /* request type of each kept event, 0 if dropped */
+    int *ids;          /* its id */
+    size_t i, cap, live = 0, peak = 0, skipped = 0;
+    int num_ids = 0, num_ops = 0;
+    slot_t *s;
+
+    qsort(ev, n, sizeof(event_t), by_seq);
+    for (cap = 16; cap < 2 * n + 16; cap <<= 1)
+	;
+    table = real_calloc(cap, sizeof(slot_t));
+    ops = real_malloc(n + 1);
+    ids = real_malloc((n + 1) * sizeof(int));
+    if (table == NULL || ops == NULL || ids == NULL) {
+	fprintf(stderr, "mmrecord: out of memory converting %s\n", raw_path);
+	return;
+    }
+    table_mask = cap - 1;
+
+    /* Assign ids and drop events about blocks we never saw allocated */
+    for (i = 0; i < n; i++) {
+	ops[i] = 0;
+	if (ev[i].size == 0 && ev[i].type != EV_FREE)
+	    ev[i].size = 1;
+	if (ev[i].size > TRACE_MAX_SIZE && ev[i].type != EV_FREE) {
+	    skipped++;
+	    if (ev[i].type == EV_REALLOC && (s = lookup(ev[i].old)) != NULL) {
+		ids[i] = s->id;  /* the block ends here in the trace */
+		live -= s->size;
+		delete(s);
+		ops[i] = 'f';
+		num_ops++;
+	    }
+	    continue;
+	}
+	switch (ev[i].type) {
+	case EV_REALLOC:
+	    if ((s = lookup(ev[i].old)) != NULL) {
+		ids[i] = s->id;
+		live -= s->size;
+		delete(s);
+		ops[i] = 'r';
+		break;
+	    }
+	    /* fall through: treat a realloc of an unknown block as malloc */
+	case EV_ALLOC:
+	    ids[i] = num_ids++;
+	    ops[i] = 'a';
+	    break;
+	case EV_CALLOC:
+	    ids[i] = num_ids++;
+	    ops[i] = 'c';
+	    break;
+	case EV_MEMALIGN:
+	    ids[i] = num_ids++;
+	    ops[i] = 'm';
+	    break;
+	case EV_FREE:
+	    if ((s = lookup(ev[i].ptr)) == NULL)
+		continue;
+	    ids[i] = s->id;
+	    live -= s->size;
+	    delete(s);
+	    ops[i] = 'f';
+	    num_ops++;
+	    continue;
+	}
+	if ((s = lookup(ev[i].ptr)) != NULL) { /* see the file comment */
+	    live -= s->size;
+	    delete(s);
+	}
+	insert(ev[i].ptr, ids[i], ev[i].size);
+	live += ev[i].size;
+	peak = (live > peak) ? live : peak;
+	num_ops++;
+    }
+
+    if (skipped > 0)
+	fprintf(stderr, "mmrecord: skipped %lu requests larger than %d bytes\n",
+		(unsigned long)skipped, TRACE_MAX_SIZE);
+    if ((out = fopen(out_path, "w")) == NULL) {
+	fprintf(stderr, "mmrecord: could not create %s\n", out_path);
+	return;
+    }
+    fprintf(out, "%lu\n%d\n%d\n%d\n", (unsigned long)peak, num_ids, num_ops, 1);
+    for (i = 0; i < n; i++) {
+	if (ops[i] == 'f')
+	    fprintf(out, "f %d\n", ids[i]);
+	else if (ops[i] == 'm')
+	    fprintf(out, "m %d %lu %u\n", ids[i], (unsigned long)ev[i].size,
+		    ev[i].align);
+	else if (ops[i] != 0)
+	    fprintf(out, "%c %d %lu\n", ops[i], ids[i], (unsigned long)ev[i].size);
+    }
+    fclose(out);
+    real_free(ids);
+    real_free(ops);
+    real_free(table);
+}
+
+/*
+ * child_after_fork - A forked child keeps its parent's log open but
+ *     must not add to it or convert it
+ */
+static void child_after_fork(void)
+{
+    recording = 0;
+    raw_fd = -1;
+    pthread_mutex_init(&bufs_lock, NULL); /* another thread may have held it */
+    all_bufs = NULL;
+    my_buf = NULL;
+    pthread_setspecific(buf_key, NULL);   /* the list no longer holds it */
+}
+
+__attribute__((constructor))
+static void mmrecord_init(void)
+{
+    char *out;
+
+    resolve();
+    if ((out = getenv("MMRECORD_OUT")) == NULL)
+	out = "mmrecord.rep";
+    if (strlen(out) + 5 > MAXLINE)
+	return;
+    strcpy(out_path, out);
+    sprintf(raw_path, "%s.raw", out);
+    in_hook = 1;
+    pthread_key_create(&buf_key, thread_exit);
+    pthread_atfork(NULL, NULL, child_after_fork);
+    in_hook = 0;
+    raw_fd = open(raw_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (raw_fd < 0) {
+	fprintf(stderr, "mmrecord: could not create %s\n", raw_path);
+	return;
+    }
+    recording = 1;
+}
+
+__attribute__((destructor))
+static void mmrecord_fini(void)
+{
+    evbuf_t *b;
+    struct stat st;
+    event_t *ev;
+    int fd;
+
+    if (!recording)
+	return;
+    recording = 0;
+    pthread_mutex_lock(&bufs_lock);
+    for (b = all_bufs; b != NULL; b = b->next)
+	flush_buf(b);
+    pthread_mutex_unlock(&bufs_lock);
+    close(raw_fd);
+    raw_fd = -1;
+
+    if ((fd = open(raw_path, O_RDWR)) < 0 || fstat(fd, &st) < 0)
+	return;
+    ev = NULL;
+    if (st.st_size > 0) {
+	ev = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (ev == MAP_FAILED)
+	    ev = NULL;
+    }
+    close(fd);
+    emit_rep(ev, ev == NULL ? 0 : st.st_size / sizeof(event_t));
+    if (ev != NULL)
+	munmap(ev, st.st_size);
+    unlink(raw_path);
+}
@@ -0,0 +1,144 @@
+/*
+ * rep2bin.c - Convert a .rep trace file to the binary trace format
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ *
+ * The output can be passed to mdriver -f or listed among its trace
+ * files like any .rep file; mdriver tells the formats apart by their
+ * first bytes. See tracefmt.h for the layout. An "e" line is written
+ * as an EPOCH record and the FREE records it stands for, and the
+ * header's op count is patched to match at the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefmt.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/*
+ * app_error - Report an error and terminate
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "rep2bin: %s\n", msg);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in, *out;
+    trace_hdr_t hdr;
+    traceop_t op;
+    trace_live_t live;
+    char type[MAXLINE];
+    char msg[MAXLINE];
+    unsigned index, size, align;
+    unsigned max_index = 0;
+    int n = 0, lines = 0, lg;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s <in.rep> <out.bin>\n", argv[0]);
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL) {
+	sprintf(msg, "Could not open %s", argv[1]);
+	app_error(msg);
+    }
+    if ((out = fopen(argv[2], "wb")) == NULL) {
+	sprintf(msg, "Could not create %s", argv[2]);
+	app_error(msg);
+    }
+
+    /* The header fields come first, in the same order as in the .rep */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	app_error("Malformed trace header");
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    if (trace_live_init(&live, hdr.num_ids) < 0)
+	app_error("Out of memory");
+
+    /* Then one fixed-size record per request line */
+    memset(&op, 0, sizeof(op));
+    while (fscanf(in, "%s", type) != EOF) {
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	case 'c':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		app_error("Malformed request line");
+	    op.type = (type[0] == 'a') ? ALLOC : (type[0] == 'r') ? REALLOC : CALLOC;
+	    op.size = size;
+	    op.align = 0;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'm':
+	    if (fscanf(in, "%u %u %u", &index, &size, &align) != 3)
+		app_error("Malformed request line");
+	    if ((lg = trace_align_log2(align)) < 0)
+		app_error("Bad memalign alignment");
+	    op.type = MEMALIGN;
+	    op.size = size;
+	    op.align = lg;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		app_error("Malformed request line");
+	    op.type = FREE;
+	    op.size = 0;
+	    op.align = 0;
+	    size = 0;
+	    break;
+	case 'e':
+	    op.type = EPOCH;
+	    op.index = 0;
+	    op.size = op.align = 0;
+	    fwrite(&op, sizeof(op), 1, out);
+	    n++;
+	    op.type = FREE;
+	    while (live.n > 0) {
+		op.index = live.ids[live.n - 1];
+		trace_live_op(&live, FREE, op.index);
+		fwrite(&op, sizeof(op), 1, out);
+		n++;
+	    }
+	    lines++;
+	    continue;
+	default:
+	    sprintf(msg, "Bogus type character (%c)", type[0]);
+	    app_error(msg);
+	}
+	if (size > TRACE_MAX_SIZE)
+	    app_error("Request too large for a binary trace");
+	if (trace_live_op(&live, op.type, index) < 0) {
+	    sprintf(msg, "Bad use of block id %u", index);
+	    app_error(msg);
+	}
+	op.index = index;
+	fwrite(&op, sizeof(op), 1, out);
+	n++;
+	lines++;
+    }
+
+    if (lines != hdr.num_ops || max_index != (unsigned)hdr.num_ids - 1) {
+	sprintf(msg, "Header says %d ops and %d ids, found %d ops and %u ids",
+		hdr.num_ops, hdr.num_ids, lines, max_index + 1);
+	app_error(msg);
+    }
+    if (n != hdr.num_ops) {
+	hdr.num_ops = n;
+	if (fseek(out, 0, SEEK_SET) != 0)
+	    app_error("Seek failed");
+	fwrite(&hdr, sizeof(hdr), 1, out);
+    }
+    trace_live_free(&live);
+    if (fclose(out) != 0)
+	app_error("Write failed");
+    fclose(in);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * tracefmt.h - The binary trace format shared by mdriver and rep2bin
+ *
+ * A binary trace is a trace_hdr_t followed by num_ops traceop_t
+ * records, all in host byte order. The records have the same layout as
+ * the driver's in-memory ops array, so mdriver maps the file and uses
+ * the records in place instead of parsing them.
+ *
+ * Version 2 added the calloc and memalign requests, which a .rep file
+ * writes as "c <id> <size>" and "m <id> <size> <alignment>". Version 3
+ * added the EPOCH marker of arena workloads: a .rep "e" line frees every
+ * block still allocated, and is stored as an EPOCH record followed by
+ * one FREE record per such block, so that mdriver -A can reset an arena
+ * at the marker and skip the frees, while the normal replay frees the
+ * blocks one by one.
+ */
+#ifndef __TRACEFMT_H_
+#define __TRACEFMT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TRACE_MAGIC   "MMTR" /* first four bytes of a binary trace */
+#define TRACE_VERSION 3
+#define TRACE_MIN_VERSION 2  /* oldest version that can still be read */
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC, CALLOC, MEMALIGN, EPOCH};
+
+#define TRACE_MAX_SIZE  ((1 << 28) - 1) /* largest request a trace can hold */
+#define TRACE_MAX_ALIGN (1 << 15)       /* largest memalign alignment */
+
+/* Characterizes a single trace operation (allocator request) in 8 bytes */
+typedef struct {
+    unsigned int type : 3;    /* type of request */
+    unsigned int index : 29;  /* index for free() to use later */
+    unsigned int size : 28;   /* byte size of alloc/realloc request */
+    unsigned int align : 4;   /* log2 of the alignment of a memalign */
+} traceop_t;
+
+/*
+ * trace_align_log2 - log2 of a memalign alignment from a .rep line, or
+ *     -1 unless it is a power of two of at most TRACE_MAX_ALIGN
+ */
+static inline int trace_align_log2(unsigned int align)
+{
+    int lg = 0;
+
+    if (align == 0 || (align & (align - 1)) || align > TRACE_MAX_ALIGN)
+	return -1;
+    while ((1u << lg) < align)
+	lg++;
+    return lg;
+}
+
+/*
+ * The ids that are allocated at the current line of a .rep trace. The
+ * readers keep track of them to expand an "e" line into FREE records,
+ * and to reject a trace that frees a block twice.
+ */
+typedef struct {
+    int num_ids;        /* ids run from 0 to num_ids - 1 */
+    int *slot;          /* position of each id in ids[], -1 if not allocated */
+    uint32_t *ids;      /* the allocated ids, in no particular order */
+    int n;              /* number of them */
+} trace_live_t;
+
+/*
+ * trace_live_init - Start with no id allocated. Returns -1 if out of memory
+ */
+static inline int trace_live_init(trace_live_t *l, int num_ids)
+{
+    int i;
+
+    l->num_ids = num_ids;
+    l->n = 0;
+    l->slot = (int *)malloc((num_ids > 0 ? num_ids : 1) * sizeof(int));
+    l->ids = (uint32_t *)malloc((num_ids > 0 ? num_ids : 1) * sizeof(uint32_t));
+    if (l->slot == NULL || l->ids == NULL)
+	return -1;
+    for (i = 0; i < num_ids; i++)
+	l->slot[i] = -1;
+    return 0;
+}
+
+/*
+ * trace_live_op - Apply one request of the given type to id in O(1).
+ *     Returns -1 if id is out of range, or if the request allocates a
+ *     block that is already allocated or reallocates or frees one that
+ *     isn't.
+ */
+static inline int trace_live_op(trace_live_t *l, int type, unsigned int id)
+{
+    uint32_t last;
+
+    if (id >= (unsigned int)l->num_ids)
+	return -1;
+    switch (type) {
+    case REALLOC:
+	return l->slot[id] < 0 ? -1 : 0;
+    case FREE:
+	if (l->slot[id] < 0)
+	    return -1;
+	last = l->ids[--l->n];
+	l->ids[l->slot[id]] = last;
+	l->slot[last] = l->slot[id];
+	l->slot[id] = -1;
+	return 0;
+    default:
+	if (l->slot[id] >= 0)
+	    return -1;
+	l->slot[id] = l->n;
+	l->ids[l->n++] = id;
+	return 0;
+    }
+}
+
+/* trace_live_free - Free the arrays of l */
+static inline void trace_live_free(trace_live_t *l)
+{
+    free(l->slot);
+    free(l->ids);
+}
+
+/* Header of a binary trace file */
+typedef struct {
+    char magic[4];         /* TRACE_MAGIC, not NUL terminated */
+    uint32_t version;      /* TRACE_VERSION */
+    int32_t sugg_heapsize; /* the four header fields of a .rep file */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} trace_hdr_t;
+
+#endif /* __TRACEFMT_H_ */